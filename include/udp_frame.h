@@ -0,0 +1,45 @@
+// ======================== UDP FRAME TRANSPORT ========================
+// Wire format of the loss-tolerant UDP stream, shared by the firmware and
+// the Linux reference receiver (tools/udp_receiver.cpp).
+//
+// Each JPEG is split into frag_count datagrams of at most
+// UDP_FRAME_MAX_PAYLOAD bytes. With FEC on, every group of fec_group data
+// fragments is followed by one parity fragment (XOR of the group, shorter
+// fragments zero-padded), which lets the receiver rebuild one lost fragment
+// per group. A receiver never waits for a lost fragment: as soon as a newer
+// frame completes, every older incomplete frame is discarded.
+//
+// Subscription runs over the discovery port (9999), renewed by the client
+// at least every UDP_SUB_TTL_MS:
+//   "ROADSAFE_UDP_SUBSCRIBE:<port>[:<fec_group>[:<min_quality>]]"
+//                                               → "ROADSAFE_UDP_OK:<ttl_ms>"
+//   "ROADSAFE_UDP_UNSUBSCRIBE:<port>"
+//
+// All multi-byte fields are little-endian (native on ESP32 and x86/ARM hosts).
+#pragma once
+
+#include <stdint.h>
+
+#define UDP_FRAME_MAGIC 0x5352          // "RS" on the wire
+#define UDP_FRAME_VERSION 1
+#define UDP_FRAME_MAX_PAYLOAD 1400      // Stays under a 1500-byte MTU
+#define UDP_FRAME_MAX_FEC_GROUP 16
+#define UDP_SUB_TTL_MS 5000
+
+#define UDP_FRAME_FLAG_PARITY 0x01      // Payload is the XOR of a fragment group
+
+struct __attribute__((packed)) UdpFrameHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t frame_id;          // Increments per frame sent to this subscriber
+    uint32_t frame_len;         // Total JPEG bytes
+    uint32_t timestamp_ms;      // Device millis() at capture
+    uint16_t frag_index;        // Data fragment index, or group index if PARITY
+    uint16_t frag_count;        // Data fragments in this frame
+    uint16_t payload_len;
+    uint8_t fec_group;          // Data fragments per parity fragment, 0 = no FEC
+    uint8_t quality;            // Source quality score 0-100 (see scoreFrame())
+};
+
+static_assert(sizeof(UdpFrameHeader) == 24, "UdpFrameHeader must stay 24 bytes");
@@ -6,6 +6,11 @@
 #include <ArduinoJson.h>
 #include "soc/rtc_cntl_reg.h"
 #include <Preferences.h>
+#include "web_assets.h"
+#include "udp_frame.h"
+#include "esp_freertos_hooks.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
 
 // ======================== CAMERA PINS (AI-Thinker) ========================
 #define PWDN_GPIO_NUM     32
@@ -38,12 +43,33 @@
 #define DISCOVERY_PORT 9999
 #define DEVICE_NAME "RoadSafe-AI-ESP32CAM"
 
+// Descriptor protocol (probe "ROADSAFE_DISCOVER_V1" → "ROADSAFE_INFO:{json}").
+// Bump DISCOVERY_PROTO_VERSION whenever a field changes meaning.
+#define DISCOVERY_PROTO_VERSION 1
+#define DISCOVERY_ANNOUNCE_PORT 9998
+#define DISCOVERY_ANNOUNCE_MS 2000      // Multicast announcement period
+#define DISCOVERY_REFRESH_MS 500        // Live-load sampling period
+const IPAddress DISCOVERY_MCAST_GROUP(239, 255, 42, 99);
+
+// Capability bits, mirrored as names in the descriptor's "caps" array
+#define CAP_MJPEG   (1 << 0)
+#define CAP_JPEG    (1 << 1)
+#define CAP_UDP     (1 << 2)    // Fragmented UDP frames, see udp_frame.h
+
+struct CapabilityName { uint32_t bit; const char *name; };
+const CapabilityName CAPABILITY_NAMES[] = {
+    {CAP_MJPEG, "mjpeg"},
+    {CAP_JPEG,  "jpeg"},
+    {CAP_UDP,   "udp"},
+};
+const uint32_t DEVICE_CAPS = CAP_MJPEG | CAP_JPEG | CAP_UDP;
+
 WiFiUDP udp;
 bool discoveryEnabled = false;
 
 Preferences preferences;
-String saved_ssid = "";
-String saved_password = "";
+char saved_ssid[33] = "";
+char saved_password[65] = "";
 bool wifi_configured = false;
 
 httpd_handle_t camera_httpd = NULL;
@@ -66,6 +92,12 @@ volatile bool stream_running = false;
 unsigned long alarm_start_time = 0;
 int total_drowsiness_alerts = 0;
 
+// Live load, published through the discovery descriptor
+volatile int stream_clients = 0;
+volatile uint8_t stream_fps = 0;
+
+TaskHandle_t streamTaskHandle = NULL;
+
 // ======================== BUZZER TASK (Core 0) ========================
 TaskHandle_t buzzerTaskHandle = NULL;
 
@@ -102,26 +134,715 @@ void buzzerTask(void * parameter) {
     }
 }
 
+// ======================== CPU LOAD ========================
+// Sampled from each core's FreeRTOS tick interrupt: a tick counts as idle
+// if it interrupted that core's idle task. At a 1 kHz tick that is ~2000
+// samples per core per discovery window, and the idle task still sleeps
+// in WFI between interrupts.
+static TaskHandle_t idle_task[2] = {NULL, NULL};
+static volatile uint32_t idle_ticks[2] = {0, 0};    // Monotonic, wrap safely
+static volatile uint32_t total_ticks[2] = {0, 0};
+uint8_t cpu_idle_pct = 100;                         // Least idle core, 0-100
+
+static inline void sampleTick(int core) {
+    total_ticks[core]++;
+    if (xTaskGetCurrentTaskHandleForCPU(core) == idle_task[core]) idle_ticks[core]++;
+}
+
+static void IRAM_ATTR tickHookCore0() { sampleTick(0); }
+static void IRAM_ATTR tickHookCore1() { sampleTick(1); }
+
+void setupCpuLoad() {
+    idle_task[0] = xTaskGetIdleTaskHandleForCPU(0);
+    idle_task[1] = xTaskGetIdleTaskHandleForCPU(1);
+    esp_register_freertos_tick_hook_for_cpu(tickHookCore0, 0);
+    esp_register_freertos_tick_hook_for_cpu(tickHookCore1, 1);
+}
+
+// Call periodically; updates cpu_idle_pct over the elapsed window
+void updateCpuLoad() {
+    static uint32_t idleStart[2] = {0, 0};
+    static uint32_t totalStart[2] = {0, 0};
+
+    uint8_t least = 100;
+    for (int core = 0; core < 2; core++) {
+        uint32_t idle = idle_ticks[core];
+        uint32_t total = total_ticks[core];
+        uint32_t ticks = total - totalStart[core];
+        if (ticks > 0) {
+            uint32_t pct = (uint64_t)(idle - idleStart[core]) * 100 / ticks;
+            if (pct > 100) pct = 100;
+            if (pct < least) least = pct;
+        }
+        idleStart[core] = idle;
+        totalStart[core] = total;
+    }
+    cpu_idle_pct = least;
+}
+
+// ======================== MEMORY POOLS ========================
+// Long drives must not end in an allocation failure, so steady-state
+// allocations stay off the general heap:
+//   - BlockPool: fixed-size blocks carved out once at boot. Internal SRAM
+//     for small latency-critical objects, PSRAM for bulk scratch buffers.
+//   - Arena: bump allocator in PSRAM, reset at the start of every HTTP
+//     request. Holds request bodies, JSON documents and response text.
+// Neither grows after boot. Running out is counted and the caller degrades
+// (drops the event, answers 500) instead of fragmenting the heap.
+#define MEM_ALIGN 8
+
+struct BlockPool {
+    const char *name;
+    size_t block_size;
+    uint16_t blocks;
+    uint32_t caps;              // Preferred heap; falls back to any 8-bit heap
+    uint8_t *storage;
+    void *free_list;
+    uint16_t in_use;
+    uint16_t high_water;
+    uint32_t failures;
+    portMUX_TYPE mux;
+};
+
+struct Arena {
+    const char *name;
+    size_t capacity;
+    uint32_t caps;
+    uint8_t *base;
+    size_t used;
+    size_t last;                // Offset of the most recent allocation
+    size_t high_water;
+    uint32_t failures;
+};
+
+// SSE events: 256-byte payload plus id/event framing, see sseFormat()
+BlockPool event_pool = {"sse_events", 352, 12, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT};
+// UDP fragment + parity scratch, held while UDP subscribers exist
+BlockPool bulk_pool = {"bulk", 1536, 4, MALLOC_CAP_SPIRAM};
+// One arena per httpd task; only one of the two servers ever runs
+Arena request_arena = {"request", 16 * 1024, MALLOC_CAP_SPIRAM};
+
+static void *capsAlloc(size_t len, uint32_t caps) {
+    void *p = heap_caps_malloc(len, caps);
+    if (!p) p = heap_caps_malloc(len, MALLOC_CAP_8BIT);     // No PSRAM fitted
+    return p;
+}
+
+bool poolInit(BlockPool &p) {
+    p.block_size = (p.block_size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    p.storage = (uint8_t *)capsAlloc(p.block_size * p.blocks, p.caps);
+    if (!p.storage) return false;
+    p.free_list = NULL;
+    for (int i = p.blocks - 1; i >= 0; i--) {
+        void *block = p.storage + i * p.block_size;
+        *(void **)block = p.free_list;
+        p.free_list = block;
+    }
+    p.mux = portMUX_INITIALIZER_UNLOCKED;
+    return true;
+}
+
+void *poolAlloc(BlockPool &p) {
+    portENTER_CRITICAL(&p.mux);
+    void *block = p.free_list;
+    if (block) {
+        p.free_list = *(void **)block;
+        if (++p.in_use > p.high_water) p.high_water = p.in_use;
+    } else {
+        p.failures++;
+    }
+    portEXIT_CRITICAL(&p.mux);
+    return block;
+}
+
+void poolFree(BlockPool &p, void *block) {
+    if (!block) return;
+    portENTER_CRITICAL(&p.mux);
+    *(void **)block = p.free_list;
+    p.free_list = block;
+    p.in_use--;
+    portEXIT_CRITICAL(&p.mux);
+}
+
+bool arenaInit(Arena &a) {
+    a.base = (uint8_t *)capsAlloc(a.capacity, a.caps);
+    return a.base != NULL;
+}
+
+void *arenaAlloc(Arena &a, size_t len) {
+    size_t start = (a.used + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+    if (!a.base || start + len > a.capacity) {
+        a.failures++;
+        return NULL;
+    }
+    a.last = start;
+    a.used = start + len;
+    if (a.used > a.high_water) a.high_water = a.used;
+    return a.base + start;
+}
+
+// Only the most recent allocation can be resized, which is all ArduinoJson's
+// shrinkToFit() needs
+void *arenaRealloc(Arena &a, void *ptr, size_t len) {
+    if (!ptr) return arenaAlloc(a, len);
+    if ((uint8_t *)ptr != a.base + a.last || a.last + len > a.capacity) return NULL;
+    a.used = a.last + len;
+    if (a.used > a.high_water) a.high_water = a.used;
+    return ptr;
+}
+
+void arenaReset(Arena &a) {
+    a.used = 0;
+    a.last = 0;
+}
+
+// Each one independently: a missing pool only degrades its own users
+void memoryInit() {
+    for (BlockPool *p : {&event_pool, &bulk_pool}) {
+        if (poolInit(*p)) Serial.printf("✓ Pool %s: %ux%u\n", p->name, p->blocks, p->block_size);
+        else Serial.printf("❌ Pool %s: %u bytes not available\n", p->name, p->blocks * p->block_size);
+    }
+    if (arenaInit(request_arena)) Serial.printf("✓ Arena %s: %u bytes\n", request_arena.name, request_arena.capacity);
+    else Serial.printf("❌ Arena %s: %u bytes not available\n", request_arena.name, request_arena.capacity);
+}
+
+// ArduinoJson documents backed by the request arena
+struct RequestArenaAllocator {
+    void *allocate(size_t n) { return arenaAlloc(request_arena, n); }
+    void deallocate(void *) {}
+    void *reallocate(void *ptr, size_t n) { return arenaRealloc(request_arena, ptr, n); }
+};
+typedef BasicJsonDocument<RequestArenaAllocator> RequestJsonDocument;
+
+// Response text built in the request arena
+struct TextBuffer {
+    char *buf;
+    size_t cap;
+    size_t len;
+};
+
+bool textInit(TextBuffer &t, size_t cap) {
+    t.buf = (char *)arenaAlloc(request_arena, cap);
+    t.cap = t.buf ? cap : 0;
+    t.len = 0;
+    if (t.buf) t.buf[0] = '\0';
+    return t.buf != NULL;
+}
+
+void textAppend(TextBuffer &t, const char *fmt, ...) {
+    if (t.len + 1 >= t.cap) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(t.buf + t.len, t.cap - t.len, fmt, args);
+    va_end(args);
+    if (n > 0) t.len = (t.len + n < t.cap) ? t.len + n : t.cap - 1;
+}
+
+// JSON string contents with quotes, backslashes and control chars escaped
+void textAppendEscaped(TextBuffer &t, const char *s) {
+    for (; *s && t.len + 7 < t.cap; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            t.buf[t.len++] = '\\';
+            t.buf[t.len++] = c;
+        } else if (c < 0x20) {
+            t.len += snprintf(t.buf + t.len, t.cap - t.len, "\\u%04x", c);
+        } else {
+            t.buf[t.len++] = c;
+        }
+    }
+    t.buf[t.len] = '\0';
+}
+
+void textAppendIP(TextBuffer &t, IPAddress ip) {
+    textAppend(t, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
+
+// ======================== FRAME QUALITY ========================
+// Cheap per-frame quality signals so analyzers can skip useless frames:
+//   - JPEG size against its running average (lens covered, flat exposure)
+//   - sharpness: byte density of the busiest restart-marker segments. Blur
+//     strips high-frequency coefficients, so the most detailed part of the
+//     image compresses much smaller than usual. Unknown (and not scored)
+//     when the JPEG has no restart markers
+//   - OV2640 exposure (AEC lines) and gain read back from the sensor, which
+//     tell under/over-exposure and an AEC that is still settling
+// The score (0-100) goes into every /stream part header and UDP frame
+// header; clients can ask for frames below a threshold to be dropped here.
+#define QUALITY_EMA_SHIFT 3             // Running averages span ~8 frames
+#define QUALITY_SENSOR_EVERY 4          // Register readback every Nth frame
+#define QUALITY_SETTLE_PCT 25           // AEC change between readbacks = settling
+#define QUALITY_BLUR_PCT 75             // Sharpness below this % of average = blur
+#define QUALITY_SMALL_PCT 60            // Size below this % of average
+#define QUALITY_DARK_GAIN_X16 (16 * 16) // Gain at/above 16x = not enough light
+#define QUALITY_BRIGHT_AEC 8            // Exposure lines at/below this at 1x gain
+#define QUALITY_MAX_SEGMENTS 64
+
+#define QF_BLUR     (1 << 0)
+#define QF_SMALL    (1 << 1)
+#define QF_DARK     (1 << 2)
+#define QF_BRIGHT   (1 << 3)
+#define QF_SETTLING (1 << 4)
+
+struct FrameQuality {
+    uint8_t score;              // 0-100
+    uint8_t flags;              // QF_*
+    uint16_t size_pct;          // Size vs running average
+    uint16_t sharp_pct;         // Sharpness vs running average, 0 if unknown
+    uint16_t aec;               // Exposure lines, 0 if unknown
+    uint16_t gain_x16;          // Analog gain * 16, 0 if unknown
+};
+
+// Owned by the stream task
+static uint32_t quality_size_ema = 0;       // Bytes << QUALITY_EMA_SHIFT
+static uint32_t quality_sharp_ema = 0;
+static uint16_t quality_aec = 0;
+static uint16_t quality_gain_x16 = 0;
+static bool quality_settling = false;
+static uint32_t quality_frames = 0;
+
+// Reported in /status
+FrameQuality last_quality = {};
+uint32_t quality_dropped = 0;
+
+static const char *qualityFlagNames(uint8_t flags, char *buf, size_t len) {
+    static const char *names[] = {"blur", "small", "dark", "bright", "settling"};
+    size_t n = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < 5; i++) {
+        if (flags & (1 << i)) n += snprintf(buf + n, len - n, "%s%s", n ? "," : "", names[i]);
+    }
+    if (n == 0) snprintf(buf, len, "none");
+    return buf;
+}
+
+// Mean length of the top quarter of entropy-coded segments between RSTn
+// markers; 0 (unknown) when the JPEG has too few restart markers. The whole
+// scan length would just repeat the size signal and penalize small frames twice.
+static uint32_t jpegSharpness(const uint8_t *buf, size_t len) {
+    uint16_t seg[QUALITY_MAX_SEGMENTS];
+    int nseg = 0;
+    size_t segStart = 0;
+    bool inScan = false;
+
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (buf[i] != 0xFF) continue;
+        uint8_t m = buf[i + 1];
+        if (!inScan) {
+            if (m == 0xDA) {                    // SOS: scan data follows its header
+                if (i + 3 >= len) break;
+                segStart = i + 2 + ((buf[i + 2] << 8) | buf[i + 3]);
+                inScan = true;
+                i = segStart - 1;
+            }
+        } else if (m >= 0xD0 && m <= 0xD7) {    // RSTn
+            if (nseg < QUALITY_MAX_SEGMENTS) seg[nseg++] = i - segStart;
+            segStart = i + 2;
+            i++;
+        } else if (m == 0xD9) {                 // EOI
+            break;
+        }
+    }
+    if (nseg < 4) return 0;
+
+    // Partial selection: bubble the largest quarter to the front
+    int top = nseg / 4;
+    uint32_t sum = 0;
+    for (int k = 0; k < top; k++) {
+        int best = k;
+        for (int j = k + 1; j < nseg; j++) if (seg[j] > seg[best]) best = j;
+        uint16_t t = seg[k]; seg[k] = seg[best]; seg[best] = t;
+        sum += seg[k];
+    }
+    return sum / top;
+}
+
+// OV2640 sensor bank registers (bank bit 0x100 for get_reg)
+static void readSensorExposure(sensor_t *s) {
+    if (!s || !s->get_reg || s->id.PID != OV2640_PID) return;
+    int r04 = s->get_reg(s, 0x104, 0xFF);
+    int r10 = s->get_reg(s, 0x110, 0xFF);
+    int r45 = s->get_reg(s, 0x145, 0xFF);
+    int r00 = s->get_reg(s, 0x100, 0xFF);
+    if (r04 < 0 || r10 < 0 || r45 < 0 || r00 < 0) return;
+
+    uint16_t aec = ((r45 & 0x3F) << 10) | (r10 << 2) | (r04 & 0x03);
+    // Gain = (bit7+1)(bit6+1)(bit5+1)(bit4+1) * (1 + bit[3:0]/16)
+    uint16_t gain = 16 + (r00 & 0x0F);
+    for (int b = 4; b < 8; b++) if (r00 & (1 << b)) gain *= 2;
+
+    quality_settling = quality_aec > 0 &&
+        (uint32_t)abs((int)aec - (int)quality_aec) * 100 > (uint32_t)quality_aec * QUALITY_SETTLE_PCT;
+    quality_aec = aec;
+    quality_gain_x16 = gain;
+}
+
+FrameQuality scoreFrame(const camera_fb_t *fb) {
+    FrameQuality q = {};
+    uint32_t sharp = jpegSharpness(fb->buf, fb->len);
+
+    if (quality_frames++ % QUALITY_SENSOR_EVERY == 0) {
+        readSensorExposure(esp_camera_sensor_get());
+    }
+
+    if (quality_size_ema == 0) quality_size_ema = fb->len << QUALITY_EMA_SHIFT;
+    if (sharp && quality_sharp_ema == 0) quality_sharp_ema = sharp << QUALITY_EMA_SHIFT;
+    q.size_pct = (uint64_t)fb->len * 100 / ((quality_size_ema >> QUALITY_EMA_SHIFT) | 1);
+    if (sharp) q.sharp_pct = (uint64_t)sharp * 100 / ((quality_sharp_ema >> QUALITY_EMA_SHIFT) | 1);
+    q.aec = quality_aec;
+    q.gain_x16 = quality_gain_x16;
+
+    int score = 100;
+    if (sharp && q.sharp_pct < QUALITY_BLUR_PCT) {
+        q.flags |= QF_BLUR;
+        score -= (100 - q.sharp_pct) * 3 / 2;
+    }
+    if (q.size_pct < QUALITY_SMALL_PCT) {
+        q.flags |= QF_SMALL;
+        score -= (100 - q.size_pct) / 2;
+    }
+    if (q.gain_x16 >= QUALITY_DARK_GAIN_X16) {
+        q.flags |= QF_DARK;
+        score -= 30;
+    }
+    if (q.aec > 0 && q.aec <= QUALITY_BRIGHT_AEC && q.gain_x16 == 16) {
+        q.flags |= QF_BRIGHT;
+        score -= 30;
+    }
+    if (quality_settling) {
+        q.flags |= QF_SETTLING;
+        score -= 40;
+    }
+    q.score = score < 0 ? 0 : score;
+
+    // EMA += (x - EMA) / 2^shift, kept in fixed point
+    quality_size_ema += fb->len - (quality_size_ema >> QUALITY_EMA_SHIFT);
+    if (sharp) quality_sharp_ema += sharp - (quality_sharp_ema >> QUALITY_EMA_SHIFT);
+
+    last_quality = q;
+    return q;
+}
+
+// ======================== UDP FRAME STREAM ========================
+// Alternative to /stream for marginal links: each frame goes out as
+// sequenced datagrams (see include/udp_frame.h), so a lost packet costs one
+// frame instead of stalling every later frame behind a TCP retransmit.
+// Subscriptions arrive on the discovery port and expire unless renewed.
+#define UDP_MAX_SUBSCRIBERS 2
+
+struct UdpSubscriber {
+    uint32_t ip;                // Network byte order, 0 = free slot
+    uint16_t port;
+    uint8_t fec_group;          // 0 = no parity
+    uint8_t min_quality;        // Frames scoring below this are not sent
+    uint8_t slot;               // Index into udp_subs, set by udpSnapshot()
+    unsigned long expires;
+};
+
+UdpSubscriber udp_subs[UDP_MAX_SUBSCRIBERS] = {};
+portMUX_TYPE udp_subs_mux = portMUX_INITIALIZER_UNLOCKED;
+volatile int udp_stream_clients = 0;
+uint32_t udp_frames_sent = 0;
+uint32_t udp_send_errors = 0;
+
+static int udp_stream_sock = -1;
+static uint8_t *udp_packet = NULL;     // bulk_pool blocks, held while anyone subscribes
+static uint8_t *udp_parity = NULL;
+// Per subscriber, so frames dropped for one subscriber's quality threshold
+// never show up as loss to another
+static uint32_t udp_frame_id[UDP_MAX_SUBSCRIBERS] = {};
+
+bool udpSubscribe(uint32_t ip, uint16_t port, uint8_t fecGroup, uint8_t minQuality) {
+    if (fecGroup > UDP_FRAME_MAX_FEC_GROUP) fecGroup = UDP_FRAME_MAX_FEC_GROUP;
+    unsigned long now = millis();
+    int slot = -1;
+
+    portENTER_CRITICAL(&udp_subs_mux);
+    for (int i = 0; i < UDP_MAX_SUBSCRIBERS; i++) {
+        if (udp_subs[i].ip == ip && udp_subs[i].port == port) { slot = i; break; }
+        if (slot < 0 && (udp_subs[i].ip == 0 || (long)(now - udp_subs[i].expires) > 0)) slot = i;
+    }
+    bool isNew = false;
+    if (slot >= 0) {
+        isNew = !(udp_subs[slot].ip == ip && udp_subs[slot].port == port);
+        udp_subs[slot].ip = ip;
+        udp_subs[slot].port = port;
+        udp_subs[slot].fec_group = fecGroup;
+        udp_subs[slot].min_quality = minQuality;
+        udp_subs[slot].expires = now + UDP_SUB_TTL_MS;
+    }
+    portEXIT_CRITICAL(&udp_subs_mux);
+
+    if (isNew) {
+        udp_frame_id[slot] = 0;     // New session for the receiver: IDs restart at 1
+        Serial.printf("📡 UDP stream subscriber %s:%u (fec %u, min quality %u)\n",
+                      IPAddress(ip).toString().c_str(), port, fecGroup, minQuality);
+        if (streamTaskHandle) xTaskNotifyGive(streamTaskHandle);
+    }
+    return slot >= 0;
+}
+
+void udpUnsubscribe(uint32_t ip, uint16_t port) {
+    portENTER_CRITICAL(&udp_subs_mux);
+    for (int i = 0; i < UDP_MAX_SUBSCRIBERS; i++) {
+        if (udp_subs[i].ip == ip && udp_subs[i].port == port) udp_subs[i].ip = 0;
+    }
+    portEXIT_CRITICAL(&udp_subs_mux);
+}
+
+// Copies the live subscribers out (expiring stale ones) and returns their count
+static int udpSnapshot(UdpSubscriber *out) {
+    unsigned long now = millis();
+    int n = 0;
+    portENTER_CRITICAL(&udp_subs_mux);
+    for (int i = 0; i < UDP_MAX_SUBSCRIBERS; i++) {
+        if (udp_subs[i].ip == 0) continue;
+        if ((long)(now - udp_subs[i].expires) > 0) {
+            udp_subs[i].ip = 0;
+            continue;
+        }
+        out[n] = udp_subs[i];
+        out[n++].slot = i;
+    }
+    portEXIT_CRITICAL(&udp_subs_mux);
+    udp_stream_clients = n;
+    return n;
+}
+
+static void udpSendPacket(const sockaddr_in &to, const uint8_t *packet, size_t len) {
+    // lwIP runs out of pbufs when a whole frame is burst out; back off one
+    // tick and retry once before counting the fragment as lost
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (sendto(udp_stream_sock, packet, len, 0, (const sockaddr *)&to, sizeof(to)) >= 0) return;
+        if (errno != ENOMEM && errno != EAGAIN) break;
+        vTaskDelay(1);
+    }
+    udp_send_errors++;
+}
+
+void udpSendFrame(const camera_fb_t *fb, unsigned long captureMs, uint8_t quality,
+                  const UdpSubscriber *subs, int nsubs) {
+    static_assert(sizeof(UdpFrameHeader) + UDP_FRAME_MAX_PAYLOAD <= 1536, "bulk_pool block too small");
+
+    if (udp_stream_sock < 0) {
+        udp_stream_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        if (udp_stream_sock < 0) return;
+    }
+    if (!udp_packet) udp_packet = (uint8_t *)poolAlloc(bulk_pool);
+    if (!udp_parity) udp_parity = (uint8_t *)poolAlloc(bulk_pool);
+    if (!udp_packet || !udp_parity) return;
+    uint8_t *packet = udp_packet;
+    uint8_t *parity = udp_parity;
+
+    UdpFrameHeader *hdr = (UdpFrameHeader *)packet;
+    uint8_t *payload = packet + sizeof(UdpFrameHeader);
+    uint16_t count = (fb->len + UDP_FRAME_MAX_PAYLOAD - 1) / UDP_FRAME_MAX_PAYLOAD;
+    bool sent = false;
+
+    for (int s = 0; s < nsubs; s++) {
+        if (quality < subs[s].min_quality) continue;
+        sent = true;
+
+        sockaddr_in to = {};
+        to.sin_family = AF_INET;
+        to.sin_port = htons(subs[s].port);
+        to.sin_addr.s_addr = subs[s].ip;
+        uint8_t fec = subs[s].fec_group;
+        size_t parityLen = 0;
+
+        hdr->magic = UDP_FRAME_MAGIC;
+        hdr->version = UDP_FRAME_VERSION;
+        hdr->frame_id = ++udp_frame_id[subs[s].slot];
+        hdr->frame_len = fb->len;
+        hdr->timestamp_ms = captureMs;
+        hdr->frag_count = count;
+        hdr->fec_group = fec;
+        hdr->quality = quality;
+
+        for (uint16_t i = 0; i < count; i++) {
+            size_t off = (size_t)i * UDP_FRAME_MAX_PAYLOAD;
+            size_t len = fb->len - off;
+            if (len > UDP_FRAME_MAX_PAYLOAD) len = UDP_FRAME_MAX_PAYLOAD;
+
+            hdr->flags = 0;
+            hdr->frag_index = i;
+            hdr->payload_len = len;
+            memcpy(payload, fb->buf + off, len);
+            udpSendPacket(to, packet, sizeof(UdpFrameHeader) + len);
+
+            if (!fec) continue;
+            if (i % fec == 0) {
+                memset(parity, 0, UDP_FRAME_MAX_PAYLOAD);
+                parityLen = 0;
+            }
+            for (size_t b = 0; b < len; b++) parity[b] ^= payload[b];
+            if (len > parityLen) parityLen = len;
+
+            if (i % fec == fec - 1 || i == count - 1) {
+                hdr->flags = UDP_FRAME_FLAG_PARITY;
+                hdr->frag_index = i / fec;
+                hdr->payload_len = parityLen;
+                memcpy(payload, parity, parityLen);
+                udpSendPacket(to, packet, sizeof(UdpFrameHeader) + parityLen);
+            }
+        }
+    }
+    if (sent) udp_frames_sent++;
+}
+
+// Give the scratch buffers back once the last subscriber is gone
+void udpReleaseScratch() {
+    poolFree(bulk_pool, udp_packet);
+    poolFree(bulk_pool, udp_parity);
+    udp_packet = NULL;
+    udp_parity = NULL;
+}
+
 // ====================== UDP DISCOVERY ======================
+// Both replies are prebuilt. The static part of the descriptor (identity,
+// capabilities) is rendered once when discovery starts; only the live-load
+// tail is re-rendered, and only when a sampled value actually changes.
+struct DiscoveryLoad {
+    int clients;
+    int udp_clients;
+    uint8_t fps;
+    uint8_t cpu_idle;       // Percent, 5% steps
+    uint16_t heap_kb;       // 4 KB steps
+    uint16_t psram_kb;      // 4 KB steps
+    bool alarm;
+    int alerts;
+};
+
+static char discovery_legacy[96];
+static size_t discovery_legacy_len = 0;
+static char discovery_info[384];
+static size_t discovery_info_static_len = 0;    // Offset of the live-load tail
+static size_t discovery_info_len = 0;
+static uint32_t discovery_seq = 0;
+static DiscoveryLoad discovery_load;
+
+// Field by field: padding bytes aren't guaranteed to survive a copy
+static bool sameDiscoveryLoad(const DiscoveryLoad &a, const DiscoveryLoad &b) {
+    return a.clients == b.clients && a.udp_clients == b.udp_clients && a.fps == b.fps &&
+           a.cpu_idle == b.cpu_idle && a.heap_kb == b.heap_kb && a.psram_kb == b.psram_kb &&
+           a.alarm == b.alarm && a.alerts == b.alerts;
+}
+
+static DiscoveryLoad sampleDiscoveryLoad() {
+    DiscoveryLoad l;
+    l.clients = stream_clients;
+    l.udp_clients = udp_stream_clients;
+    l.fps = stream_fps;
+    l.cpu_idle = cpu_idle_pct / 5 * 5;
+    l.heap_kb = (ESP.getFreeHeap() / 1024) & ~3u;
+    l.psram_kb = (ESP.getFreePsram() / 1024) & ~3u;
+    l.alarm = (deviceState == STATE_ALARM_ACTIVE);
+    l.alerts = total_drowsiness_alerts;
+    return l;
+}
+
+static void renderDiscoveryLoad() {
+    const DiscoveryLoad &l = discovery_load;
+    int n = snprintf(discovery_info + discovery_info_static_len,
+                     sizeof(discovery_info) - discovery_info_static_len,
+                     "\"seq\":%u,\"clients\":%d,\"udp_clients\":%d,\"fps\":%u,\"cpu_idle\":%u,"
+                     "\"heap_kb\":%u,\"psram_kb\":%u,\"alarm\":%s,\"alerts\":%d}",
+                     discovery_seq, l.clients, l.udp_clients, l.fps, l.cpu_idle,
+                     l.heap_kb, l.psram_kb, l.alarm ? "true" : "false", l.alerts);
+    discovery_info_len = discovery_info_static_len + n;
+}
+
+static void buildDiscoveryReplies() {
+    IPAddress addr = WiFi.localIP();
+    char ip[16];
+    snprintf(ip, sizeof(ip), "%u.%u.%u.%u", addr[0], addr[1], addr[2], addr[3]);
+    discovery_legacy_len = snprintf(discovery_legacy, sizeof(discovery_legacy),
+                                    "ROADSAFE_RESPONSE:%s:%s", ip, DEVICE_NAME);
+
+    char caps[64] = "";
+    size_t capsLen = 0;
+    for (const CapabilityName &c : CAPABILITY_NAMES) {
+        if (!(DEVICE_CAPS & c.bit)) continue;
+        capsLen += snprintf(caps + capsLen, sizeof(caps) - capsLen, "%s\"%s\"",
+                            capsLen ? "," : "", c.name);
+    }
+
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    discovery_info_static_len = snprintf(discovery_info, sizeof(discovery_info),
+        "ROADSAFE_INFO:{\"v\":%d,\"id\":\"%02X%02X%02X\",\"name\":\"%s\",\"ip\":\"%s\","
+        "\"port\":80,\"caps\":[%s],",
+        DISCOVERY_PROTO_VERSION, mac[3], mac[4], mac[5], DEVICE_NAME, ip, caps);
+
+    discovery_load = sampleDiscoveryLoad();
+    renderDiscoveryLoad();
+}
+
 void setupUDPDiscovery() {
     if (WiFi.status() != WL_CONNECTED) return;
     if (udp.begin(DISCOVERY_PORT)) {
+        buildDiscoveryReplies();
         discoveryEnabled = true;
-        Serial.printf("📡 UDP Discovery on port %d\n", DISCOVERY_PORT);
+        Serial.printf("📡 UDP Discovery on port %d, announcing to %s:%d\n", DISCOVERY_PORT,
+                      DISCOVERY_MCAST_GROUP.toString().c_str(), DISCOVERY_ANNOUNCE_PORT);
     }
 }
 
+// Re-samples live load; the tail is only re-rendered if something changed
+void refreshDiscoveryDescriptor() {
+    if (!discoveryEnabled) return;
+    updateCpuLoad();
+    DiscoveryLoad l = sampleDiscoveryLoad();
+    if (sameDiscoveryLoad(l, discovery_load)) return;
+    discovery_load = l;
+    discovery_seq++;
+    renderDiscoveryLoad();
+}
+
+void announceDiscovery() {
+    if (!discoveryEnabled) return;
+    udp.beginPacket(DISCOVERY_MCAST_GROUP, DISCOVERY_ANNOUNCE_PORT);
+    udp.write((const uint8_t*)discovery_info, discovery_info_len);
+    udp.endPacket();
+}
+
 void handleUDPDiscovery() {
     if (!discoveryEnabled) return;
-    int packetSize = udp.parsePacket();
-    if (packetSize) {
-        char incomingPacket[255];
-        int len = udp.read(incomingPacket, 255);
-        if (len > 0) incomingPacket[len] = '\0';
-        if (String(incomingPacket) == "ROADSAFE_DISCOVER") {
-            String response = "ROADSAFE_RESPONSE:" + WiFi.localIP().toString() + ":" + DEVICE_NAME;
+    // Drain everything queued since the last poll
+    int packetSize;
+    while ((packetSize = udp.parsePacket()) > 0) {
+        char incomingPacket[48];
+        int len = udp.read(incomingPacket, sizeof(incomingPacket) - 1);
+        if (len <= 0) continue;
+        incomingPacket[len] = '\0';
+
+        const char *reply = NULL;
+        size_t replyLen = 0;
+        char subscribeReply[32];
+        if (strcmp(incomingPacket, "ROADSAFE_DISCOVER_V1") == 0) {
+            reply = discovery_info;
+            replyLen = discovery_info_len;
+        } else if (strcmp(incomingPacket, "ROADSAFE_DISCOVER") == 0) {
+            reply = discovery_legacy;
+            replyLen = discovery_legacy_len;
+        } else if (strncmp(incomingPacket, "ROADSAFE_UDP_SUBSCRIBE:", 23) == 0) {
+            unsigned port = 0, fec = 0, minQuality = 0;
+            sscanf(incomingPacket + 23, "%u:%u:%u", &port, &fec, &minQuality);
+            if (minQuality > 100) minQuality = 100;
+            if (port > 0 && port <= 65535 && udpSubscribe(udp.remoteIP(), port, fec, minQuality)) {
+                replyLen = snprintf(subscribeReply, sizeof(subscribeReply),
+                                    "ROADSAFE_UDP_OK:%d", UDP_SUB_TTL_MS);
+                reply = subscribeReply;
+            } else {
+                reply = "ROADSAFE_UDP_FULL";
+                replyLen = 17;
+            }
+        } else if (strncmp(incomingPacket, "ROADSAFE_UDP_UNSUBSCRIBE:", 25) == 0) {
+            udpUnsubscribe(udp.remoteIP(), atoi(incomingPacket + 25));
+        }
+        if (reply) {
             udp.beginPacket(udp.remoteIP(), udp.remotePort());
-            udp.write((uint8_t*)response.c_str(), response.length());
+            udp.write((const uint8_t*)reply, replyLen);
             udp.endPacket();
         }
     }
@@ -135,8 +856,240 @@ esp_err_t set_cors_headers(httpd_req_t *req) {
     return ESP_OK;
 }
 
+// ======================== DETACHED CLIENTS ========================
+// /stream and /events keep their connection open after the handler returns:
+// the handler writes the HTTP response header itself and hands the socket to
+// a worker task, so the single httpd task stays free for /alarm and /status.
+//
+// httpd still owns the session and reports its end through close_fn. The
+// worker owns the fd: it is the only one that closes it, so an fd can never
+// be recycled by httpd while the worker is still writing to it.
+#define DETACHED_MAX_CLIENTS 3
+
+enum ClientSlot : uint8_t {
+    SLOT_FREE,
+    SLOT_ACTIVE,        // Worker writes to it
+    SLOT_DROPPING,      // Worker gave up on it, waiting for httpd to close the session
+    SLOT_CLOSED         // Session is gone, worker must close() the fd
+};
+
+struct DetachedClients {
+    int fd[DETACHED_MAX_CLIENTS];
+    volatile ClientSlot slot[DETACHED_MAX_CLIENTS];
+    uint8_t param[DETACHED_MAX_CLIENTS];    // Per-client option (stream: min quality)
+    portMUX_TYPE mux;
+};
+
+// Handlers check for room, send their header, and only then add the
+// client, so the worker never writes to a socket before its header is out.
+// Only the httpd task adds clients, so the room can't disappear in between.
+static bool detachedHasRoom(DetachedClients &c) {
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (c.slot[i] == SLOT_FREE) return true;
+    }
+    return false;
+}
+
+static bool detachedAdd(DetachedClients &c, int fd, uint8_t param = 0) {
+    bool added = false;
+    portENTER_CRITICAL(&c.mux);
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (c.slot[i] == SLOT_FREE) {
+            c.fd[i] = fd;
+            c.param[i] = param;
+            c.slot[i] = SLOT_ACTIVE;
+            added = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&c.mux);
+    return added;
+}
+
+// Called from close_fn. Returns true if the fd belongs to this worker.
+// The socket is shut down first so a send the worker is blocked in returns;
+// that is safe because the worker never closes a slot before it is CLOSED.
+static bool detachedOnClose(DetachedClients &c, int fd) {
+    int owned = -1;
+    portENTER_CRITICAL(&c.mux);
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (c.slot[i] != SLOT_FREE && c.slot[i] != SLOT_CLOSED && c.fd[i] == fd) {
+            owned = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&c.mux);
+    if (owned < 0) return false;
+
+    shutdown(fd, SHUT_RDWR);
+    portENTER_CRITICAL(&c.mux);
+    c.slot[owned] = SLOT_CLOSED;
+    portEXIT_CRITICAL(&c.mux);
+    return true;
+}
+
+// Worker side: stop writing to a client and ask httpd to end its session
+static void detachedDrop(DetachedClients &c, int i) {
+    portENTER_CRITICAL(&c.mux);
+    bool active = (c.slot[i] == SLOT_ACTIVE);
+    if (active) c.slot[i] = SLOT_DROPPING;
+    portEXIT_CRITICAL(&c.mux);
+    if (active) httpd_sess_trigger_close(camera_httpd, c.fd[i]);
+}
+
+// Worker side: close fds whose session is gone. Returns the active count.
+static int detachedReap(DetachedClients &c) {
+    int active = 0;
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (c.slot[i] == SLOT_CLOSED) {
+            close(c.fd[i]);
+            portENTER_CRITICAL(&c.mux);
+            c.fd[i] = -1;
+            c.slot[i] = SLOT_FREE;
+            portEXIT_CRITICAL(&c.mux);
+        } else if (c.slot[i] == SLOT_ACTIVE) {
+            active++;
+        }
+    }
+    return active;
+}
+
+static bool sendAll(int fd, const char *buf, size_t len, int flags = 0) {
+    while (len > 0) {
+        int n = send(fd, buf, len, flags);
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+DetachedClients stream_subs = {{-1, -1, -1}, {SLOT_FREE, SLOT_FREE, SLOT_FREE}, {0, 0, 0}, portMUX_INITIALIZER_UNLOCKED};
+DetachedClients sse_subs = {{-1, -1, -1}, {SLOT_FREE, SLOT_FREE, SLOT_FREE}, {0, 0, 0}, portMUX_INITIALIZER_UNLOCKED};
+
+QueueHandle_t sseQueue = NULL;
+
+// ======================== SERVER-SENT EVENTS ========================
+// Events are serialized once into a heap block and queued; the SSE task
+// writes that same block to every subscriber and frees it. State changes
+// go out immediately, telemetry is a heartbeat of at most one per
+// SSE_HEARTBEAT_MS.
+#define SSE_QUEUE_LEN 8
+#define SSE_HEARTBEAT_MS 5000
+#define SSE_RETRY_MS 2000
+
+struct SseEvent {
+    size_t len;
+    char data[];
+};
+
+static uint32_t sse_event_id = 0;
+static portMUX_TYPE sse_id_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Formats "id/event/data" once. Returns NULL if it doesn't fit or no memory.
+// The event is formatted straight into an event_pool block.
+static SseEvent *sseFormat(const char *event, const char *fmt, va_list args) {
+    SseEvent *ev = (SseEvent *)poolAlloc(event_pool);
+    if (!ev) return NULL;
+    size_t cap = event_pool.block_size - sizeof(SseEvent);
+
+    portENTER_CRITICAL(&sse_id_mux);
+    uint32_t id = ++sse_event_id;
+    portEXIT_CRITICAL(&sse_id_mux);
+
+    size_t len = snprintf(ev->data, cap, "id: %u\nevent: %s\ndata: ", id, event);
+    int dlen = vsnprintf(ev->data + len, cap - len, fmt, args);
+    if (dlen < 0 || len + dlen + 2 >= cap) {
+        poolFree(event_pool, ev);
+        return NULL;
+    }
+    len += dlen;
+    ev->data[len++] = '\n';
+    ev->data[len++] = '\n';
+    ev->len = len;
+    return ev;
+}
+
+// Publish to all /events subscribers. Cheap no-op when nobody listens.
+void ssePublish(const char *event, const char *fmt, ...) {
+    if (!sseQueue) return;
+    bool listening = false;
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (sse_subs.slot[i] == SLOT_ACTIVE) listening = true;
+    }
+    if (!listening) return;
+
+    va_list args;
+    va_start(args, fmt);
+    SseEvent *ev = sseFormat(event, fmt, args);
+    va_end(args);
+    if (!ev) return;
+    if (xQueueSend(sseQueue, &ev, 0) != pdTRUE) poolFree(event_pool, ev);  // Queue full: drop
+}
+
+void publishStateEvent() {
+    bool alarming = (deviceState == STATE_ALARM_ACTIVE);
+    ssePublish("state", "{\"device_state\":\"%s\",\"alarm_active\":%s,\"alerts\":%d}",
+               alarming ? "ALARM_ACTIVE" : "MONITORING", alarming ? "true" : "false",
+               total_drowsiness_alerts);
+}
+
+void publishStreamEvent() {
+    ssePublish("stream", "{\"stream_running\":%s,\"clients\":%d}",
+               stream_running ? "true" : "false", stream_clients);
+}
+
+void publishTelemetryEvent() {
+    ssePublish("telemetry", "{\"rssi\":%d,\"free_heap\":%u,\"fps\":%u,\"cpu_idle\":%u,\"uptime_s\":%lu}",
+               WiFi.RSSI(), ESP.getFreeHeap(), stream_fps, cpu_idle_pct, millis() / 1000);
+}
+
+void sseTask(void * parameter) {
+    unsigned long lastHeartbeat = millis();
+
+    for (;;) {
+        SseEvent *ev = NULL;
+        xQueueReceive(sseQueue, &ev, pdMS_TO_TICKS(SSE_HEARTBEAT_MS));
+
+        // A NULL item is just a wake-up from close_fn
+        int active = detachedReap(sse_subs);
+
+        if (ev) {
+            for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+                if (sse_subs.slot[i] != SLOT_ACTIVE) continue;
+                // Never block on one slow subscriber; a partial write would
+                // also corrupt its stream, so drop it instead
+                if (!sendAll(sse_subs.fd[i], ev->data, ev->len, MSG_DONTWAIT)) {
+                    Serial.println("📣 SSE subscriber dropped (send failed)");
+                    detachedDrop(sse_subs, i);
+                }
+            }
+            poolFree(event_pool, ev);
+        }
+
+        if (active > 0 && millis() - lastHeartbeat >= SSE_HEARTBEAT_MS) {
+            lastHeartbeat = millis();
+            publishTelemetryEvent();
+        }
+    }
+}
+
+// close_fn for the camera server: hand detached fds back to their worker
+static void camera_sock_close(httpd_handle_t hd, int sockfd) {
+    if (detachedOnClose(stream_subs, sockfd)) {
+        if (streamTaskHandle) xTaskNotifyGive(streamTaskHandle);
+        return;
+    }
+    if (detachedOnClose(sse_subs, sockfd)) {
+        SseEvent *wake = NULL;
+        xQueueSend(sseQueue, &wake, 0);
+        return;
+    }
+    close(sockfd);
+}
+
 // ====================== WiFi STORAGE ======================
-void saveWiFiCredentials(String ssid, String password) {
+void saveWiFiCredentials(const char *ssid, const char *password) {
     preferences.begin("wifi", false);
     preferences.putString("ssid", ssid);
     preferences.putString("password", password);
@@ -146,11 +1099,12 @@ void saveWiFiCredentials(String ssid, String password) {
 
 bool loadWiFiCredentials() {
     preferences.begin("wifi", true);
-    saved_ssid = preferences.getString("ssid", "");
-    saved_password = preferences.getString("password", "");
+    saved_ssid[0] = saved_password[0] = '\0';
+    preferences.getString("ssid", saved_ssid, sizeof(saved_ssid));
+    preferences.getString("password", saved_password, sizeof(saved_password));
     wifi_configured = preferences.getBool("configured", false);
     preferences.end();
-    return wifi_configured && saved_ssid.length() > 0;
+    return wifi_configured && saved_ssid[0] != '\0';
 }
 
 void clearWiFiCredentials() {
@@ -159,285 +1113,774 @@ void clearWiFiCredentials() {
     preferences.end();
 }
 
-// ====================== SETUP PAGE HTML ======================
-const char setup_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>RoadSafe AI - WiFi Setup</title>
-    <style>
-        * { margin: 0; padding: 0; box-sizing: border-box; }
-        body { font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Roboto, sans-serif; background: linear-gradient(135deg, #667eea 0%, #764ba2 100%); min-height: 100vh; display: flex; align-items: center; justify-content: center; padding: 20px; }
-        .container { background: white; border-radius: 20px; box-shadow: 0 20px 60px rgba(0,0,0,0.3); max-width: 500px; width: 100%; overflow: hidden; }
-        .header { background: linear-gradient(135deg, #667eea 0%, #764ba2 100%); color: white; padding: 30px; text-align: center; }
-        .header h1 { font-size: 28px; margin-bottom: 10px; }
-        .header p { opacity: 0.9; font-size: 14px; }
-        .icon { width: 60px; height: 60px; margin: 0 auto 15px; background: rgba(255,255,255,0.2); border-radius: 15px; display: flex; align-items: center; justify-content: center; font-size: 30px; }
-        .content { padding: 30px; }
-        .form-group { margin-bottom: 20px; }
-        label { display: block; margin-bottom: 8px; color: #333; font-weight: 500; font-size: 14px; }
-        input, select { width: 100%; padding: 12px 15px; border: 2px solid #e0e0e0; border-radius: 10px; font-size: 16px; transition: all 0.3s; }
-        input:focus, select:focus { outline: none; border-color: #667eea; }
-        .btn { width: 100%; padding: 15px; background: linear-gradient(135deg, #667eea 0%, #764ba2 100%); color: white; border: none; border-radius: 10px; font-size: 16px; font-weight: 600; cursor: pointer; }
-        .scanning { text-align: center; padding: 20px; color: #666; }
-        .spinner { border: 3px solid #f3f3f3; border-top: 3px solid #667eea; border-radius: 50%; width: 40px; height: 40px; animation: spin 1s linear infinite; margin: 0 auto 15px; }
-        @keyframes spin { 0% { transform: rotate(0deg); } 100% { transform: rotate(360deg); } }
-        .status { margin-top: 20px; padding: 15px; border-radius: 10px; text-align: center; display: none; }
-        .status.success { background: #d4edda; color: #155724; }
-        .status.error { background: #f8d7da; color: #721c24; }
-        .info-box { background: #e7f3ff; border-left: 4px solid #2196F3; padding: 15px; border-radius: 8px; margin-bottom: 20px; }
-        .info-box p { color: #0c5fa8; font-size: 13px; line-height: 1.5; }
-        .password-toggle { position: relative; }
-        .toggle-btn { position: absolute; right: 12px; top: 50%; transform: translateY(-50%); background: none; border: none; cursor: pointer; font-size: 18px; }
-    </style>
-</head>
-<body>
-    <div class="container">
-        <div class="header"><div class="icon">🚗</div><h1>RoadSafe AI</h1><p>Driver Drowsiness Detection System</p></div>
-        <div class="content">
-            <div class="info-box"><p><strong>📡 Setup Required</strong><br>Connect your ESP32-CAM to your WiFi network.</p></div>
-            <div id="scanningDiv" class="scanning"><div class="spinner"></div><p>Scanning for WiFi networks...</p></div>
-            <form id="wifiForm" style="display: none;">
-                <div class="form-group"><label for="ssid">WiFi Network</label><select id="ssid" name="ssid" required><option value="">Select a network...</option></select></div>
-                <div class="form-group"><label for="password">Password</label><div class="password-toggle"><input type="password" id="password" name="password" placeholder="Enter WiFi password" required><button type="button" class="toggle-btn" onclick="togglePassword()">👁️</button></div></div>
-                <button type="submit" class="btn">Connect to WiFi</button>
-            </form>
-            <div id="status" class="status"></div>
-        </div>
-    </div>
-    <script>
-        fetch('/scan').then(r=>r.json()).then(data=>{document.getElementById('scanningDiv').style.display='none';document.getElementById('wifiForm').style.display='block';const s=document.getElementById('ssid');data.networks.forEach(n=>{const o=document.createElement('option');o.value=n.ssid;o.textContent=n.ssid+' ('+n.rssi+' dBm) '+n.encryption;s.appendChild(o);});}).catch(()=>{document.getElementById('scanningDiv').innerHTML='<p style="color:#f44336;">Failed to scan. Refresh.</p>';});
-        document.getElementById('wifiForm').addEventListener('submit',function(e){e.preventDefault();const ssid=document.getElementById('ssid').value,pw=document.getElementById('password').value,st=document.getElementById('status');st.style.display='block';st.className='status';st.textContent='⏳ Connecting...';fetch('/connect',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify({ssid:ssid,password:pw})}).then(r=>r.json()).then(d=>{if(d.success){st.className='status success';st.innerHTML='✓ Connected! IP: '+d.ip+'<br>Redirecting...';setTimeout(()=>{window.location.href='http://'+d.ip;},3000);}else{st.className='status error';st.textContent='✗ '+d.message;}}).catch(err=>{st.className='status error';st.textContent='✗ '+err.message;});});
-        function togglePassword(){const i=document.getElementById('password');i.type=i.type==='password'?'text':'password';}
-    </script>
-</body>
-</html>
-)rawliteral";
-
-// ====================== CAMERA PAGE HTML ======================
-const char camera_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>RoadSafe AI - Live Feed</title>
-    <style>
-        body { font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', sans-serif; margin: 0; background: #0f172a; color: #e2e8f0; display: flex; flex-direction: column; align-items: center; min-height: 100vh; padding: 30px 15px; }
-        h1 { margin-bottom: 5px; }
-        p.sub { margin-top: 0; color: #94a3b8; }
-        .frame { max-width: 100%; width: 420px; border-radius: 14px; box-shadow: 0 18px 40px rgba(15,23,42,0.6); overflow: hidden; background: #1e293b; border: 1px solid #334155; position: relative; min-height: 240px; }
-        .frame img { width: 100%; display: block; }
-        .paused-overlay { position: absolute; top: 0; left: 0; right: 0; bottom: 0; background: rgba(15,23,42,0.9); display: none; align-items: center; justify-content: center; flex-direction: column; }
-        .paused-overlay.show { display: flex; }
-        .paused-overlay .icon { font-size: 48px; margin-bottom: 10px; animation: pulse 1s infinite alternate; }
-        .paused-overlay p { color: #f87171; font-weight: 600; font-size: 16px; }
-        @keyframes pulse { from { opacity: 0.6; } to { opacity: 1; } }
-        .stats { margin-top: 24px; display: grid; gap: 12px; width: 420px; max-width: 100%; }
-        .card { padding: 16px 18px; border-radius: 12px; background: #1e293b; border: 1px solid #334155; display: flex; justify-content: space-between; align-items: center; }
-        .label { color: #94a3b8; font-size: 14px; }
-        .value { font-size: 18px; font-weight: 600; }
-        .status-indicator { width: 12px; height: 12px; border-radius: 50%; margin-right: 8px; }
-        .status-row { display: flex; align-items: center; }
-    </style>
-</head>
-<body>
-    <h1>RoadSafe AI</h1>
-    <p class="sub">Live stream from ESP32-CAM</p>
-    <div class="frame">
-        <img id="stream" src="/stream" alt="Live stream"/>
-        <div id="pausedOverlay" class="paused-overlay">
-            <div class="icon">🚨</div>
-            <p>DROWSINESS DETECTED</p>
-            <p style="color:#94a3b8;font-size:13px;margin-top:8px;">Buzzer active — Stream paused</p>
-        </div>
-    </div>
-    <div class="stats">
-        <div class="card"><span class="label">Status</span><span class="status-row"><span id="statusLed" class="status-indicator" style="background:#f87171"></span><span class="value" id="statusText">Loading…</span></span></div>
-        <div class="card"><span class="label">Alarm</span><span class="value" id="alarmStatus">OFF</span></div>
-        <div class="card"><span class="label">Stream</span><span class="value" id="streamStatus">-</span></div>
-        <div class="card"><span class="label">WiFi</span><span class="value" id="wifiSsid">-</span></div>
-        <div class="card"><span class="label">IP</span><span class="value" id="ipAddr">-</span></div>
-        <div class="card"><span class="label">RSSI</span><span class="value" id="rssi">-</span></div>
-        <div class="card"><span class="label">Alerts</span><span class="value" id="alerts">0</span></div>
-    </div>
-    <script>
-        let wasAlarming = false;
-        async function refreshStatus(){
-            try{
-                const r=await fetch('/status');
-                const d=await r.json();
-                const alarming = d.device_state === 'ALARM_ACTIVE';
-                
-                document.getElementById('statusText').textContent=d.status||'online';
-                document.getElementById('statusLed').style.background=alarming?'#f87171':'#34d399';
-                document.getElementById('alarmStatus').textContent=alarming?'🔊 ACTIVE':'OFF';
-                document.getElementById('alarmStatus').style.color=alarming?'#f87171':'#34d399';
-                document.getElementById('streamStatus').textContent=d.stream_running?'LIVE':'PAUSED';
-                document.getElementById('streamStatus').style.color=d.stream_running?'#34d399':'#fb923c';
-                document.getElementById('wifiSsid').textContent=d.wifi_ssid||'-';
-                document.getElementById('ipAddr').textContent=d.ip||'-';
-                document.getElementById('alerts').textContent=d.alerts??'-';
-                document.getElementById('rssi').textContent=d.rssi?d.rssi+' dBm':'-';
-                
-                // Show/hide paused overlay
-                document.getElementById('pausedOverlay').classList.toggle('show', alarming);
-                
-                // When alarm turns OFF, reconnect stream
-                if(wasAlarming && !alarming){
-                    const img = document.getElementById('stream');
-                    img.src = '/stream?t=' + Date.now();
-                }
-                wasAlarming = alarming;
-            }catch(e){
-                document.getElementById('statusText').textContent='offline';
-                document.getElementById('statusLed').style.background='#f87171';
-            }
-        }
-        refreshStatus();
-        setInterval(refreshStatus, 2000);
-    </script>
-</body>
-</html>
-)rawliteral";
-
 // ====================== HTTP HANDLERS ======================
+// Handlers allocate only from request_arena, which is reset at the top of
+// each request; both servers run all handlers on their single httpd task.
+#define REQUEST_BODY_MAX 512
+
+// Whole request body into buf as a NUL-terminated string. False if empty,
+// too big for buf, or the client stalls: a timeout fails the request so a
+// client that goes quiet mid-body can't hold the only httpd task (and with
+// it /alarm).
+static bool recvBody(httpd_req_t *req, char *buf, size_t cap) {
+    if (req->content_len == 0 || req->content_len >= cap) return false;
+    size_t got = 0;
+    while (got < req->content_len) {
+        int ret = httpd_req_recv(req, buf + got, req->content_len - got);
+        if (ret <= 0) return false;
+        got += ret;
+    }
+    buf[got] = '\0';
+    return true;
+}
+
+// Whole request body as an arena string, NULL if empty, too big or stalled
+static char *readRequestBody(httpd_req_t *req) {
+    if (req->content_len == 0 || req->content_len > REQUEST_BODY_MAX) return NULL;
+    char *body = (char *)arenaAlloc(request_arena, req->content_len + 1);
+    if (!body || !recvBody(req, body, req->content_len + 1)) return NULL;
+    return body;
+}
+
+// Formatted on the stack so even error replies work without the arena
+static esp_err_t sendJsonf(httpd_req_t *req, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, n);
+}
 
 static esp_err_t scan_handler(httpd_req_t *req) {
+    arenaReset(request_arena);
     set_cors_headers(req);
 
     int n = WiFi.scanNetworks();
+    if (n < 0) n = 0;       // WIFI_SCAN_FAILED / WIFI_SCAN_RUNNING: report no networks
 
-    String json = "{\"networks\":[";
+    TextBuffer json;
+    if (!textInit(json, 96 + n * 96)) return httpd_resp_send_500(req);
+    textAppend(json, "{\"networks\":[");
     for (int i = 0; i < n; i++) {
-        if (i > 0) json += ",";
-        json += "{";
-        json += "\"ssid\":\"" + WiFi.SSID(i) + "\",";
-        json += "\"rssi\":" + String(WiFi.RSSI(i)) + ",";
-        json += "\"encryption\":\"" + String(WiFi.encryptionType(i) == WIFI_AUTH_OPEN ? "Open" : "Secured") + "\"";
-        json += "}";
+        wifi_ap_record_t *ap = (wifi_ap_record_t *)WiFi.getScanInfoByIndex(i);
+        if (!ap) continue;
+        textAppend(json, "%s{\"ssid\":\"", i > 0 ? "," : "");
+        textAppendEscaped(json, (const char *)ap->ssid);
+        textAppend(json, "\",\"rssi\":%d,\"encryption\":\"%s\"}", ap->rssi,
+                   ap->authmode == WIFI_AUTH_OPEN ? "Open" : "Secured");
     }
-    json += "]}";
+    textAppend(json, "]}");
+    WiFi.scanDelete();
 
     httpd_resp_set_type(req, "application/json");
-    return httpd_resp_send(req, json.c_str(), json.length());
+    return httpd_resp_send(req, json.buf, json.len);
 }
 
 static esp_err_t connect_handler(httpd_req_t *req) {
-    char content[200];
-    int ret = httpd_req_recv(req, content, sizeof(content));
-    if (ret <= 0) return ESP_FAIL;
-    content[ret] = '\0';
-    DynamicJsonDocument doc(512);
-    deserializeJson(doc, content);
-    String ssid = doc["ssid"].as<String>();
-    String password = doc["password"].as<String>();
+    arenaReset(request_arena);
+    char *content = readRequestBody(req);
+    if (!content) return ESP_FAIL;
+    RequestJsonDocument doc(384);
+    if (deserializeJson(doc, content)) return ESP_FAIL;
+    const char *ssid = doc["ssid"] | "";
+    const char *password = doc["password"] | "";
     set_cors_headers(req);
-    httpd_resp_set_type(req, "application/json");
-    WiFi.begin(ssid.c_str(), password.c_str());
+    WiFi.begin(ssid, password);
     int attempts = 0;
     while (WiFi.status() != WL_CONNECTED && attempts < 20) { delay(500); attempts++; }
-    String response;
     if (WiFi.status() == WL_CONNECTED) {
         saveWiFiCredentials(ssid, password);
         setupUDPDiscovery();
-        response = "{\"success\":true,\"ip\":\"" + WiFi.localIP().toString() + "\"}";
-    } else {
-        response = "{\"success\":false,\"message\":\"Failed to connect\"}";
+        IPAddress ip = WiFi.localIP();
+        return sendJsonf(req, "{\"success\":true,\"ip\":\"%u.%u.%u.%u\"}",
+                         ip[0], ip[1], ip[2], ip[3]);
     }
-    return httpd_resp_send(req, response.c_str(), response.length());
+    return sendJsonf(req, "{\"success\":false,\"message\":\"Failed to connect\"}");
 }
 
-static esp_err_t setup_handler(httpd_req_t *req) {
+// Pages are gzipped at build time (tools/embed_web_assets.py). "no-cache"
+// makes the browser revalidate every load, which costs a 304 with no body
+// while the ETag still matches.
+static esp_err_t send_web_asset(httpd_req_t *req, const WebAsset &asset) {
     set_cors_headers(req);
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, setup_html, strlen(setup_html));
+    httpd_resp_set_hdr(req, "ETag", asset.etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    // Substring match also accepts W/"..." and comma-separated lists
+    char inm[80];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK &&
+        strstr(inm, asset.etag) != NULL) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset.type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset.data, asset.len);
+}
+
+static esp_err_t setup_handler(httpd_req_t *req) {
+    return send_web_asset(req, setup_html_asset);
 }
 
 static esp_err_t index_handler(httpd_req_t *req) {
-    set_cors_headers(req);
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, camera_html, strlen(camera_html));
+    return send_web_asset(req, camera_html_asset);
 }
 
-// ======================== STREAM HANDLER ========================
-// This is the critical handler. It runs in a tight loop sending MJPEG frames.
-// When stream_must_stop becomes true, it breaks out IMMEDIATELY,
-// freeing GPIO 13 for the buzzer.
-static esp_err_t stream_handler(httpd_req_t *req) {
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-    char part_buf[64];
-    static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=frame";
-    static const char* _STREAM_BOUNDARY = "\r\n--frame\r\n";
-    static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+// ======================== STREAM WATCHDOG ========================
+// Every stage of the capture path has a deadline. The health task (Core 0)
+// watches the stage the stream task is in; a capture that overruns marks the
+// camera faulty and the health task deinits/reinits the driver while the
+// stream task waits. Sends are bounded by SO_SNDTIMEO on each client socket,
+// and the alarm handshake by stopStreamBounded().
+#define CAPTURE_DEADLINE_MS 1000        // esp_camera_fb_get() itself gives up after 4 s
+#define SEND_DEADLINE_MS 1500           // One frame to one client
+#define ALARM_HANDSHAKE_MS 250          // Graceful stream stop before forcing it
+#define CAPTURE_FAIL_LIMIT 3            // Consecutive NULL frames before a reinit
+#define WATCHDOG_PERIOD_MS 50
+#define RECOVERY_LOCK_MS 5000           // Wait for the capture path to let go
+#define RECOVERY_BACKOFF_MS 2000        // Between failed reinit attempts
+
+enum StreamStage : uint8_t {
+    STAGE_IDLE,
+    STAGE_CAPTURE,
+    STAGE_SEND
+};
 
-    // Don't allow stream to start if alarm is active
-    if (deviceState == STATE_ALARM_ACTIVE) {
-        set_cors_headers(req);
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_send(req, "Stream paused: alarm active", 27);
-        return ESP_OK;
+struct HealthStats {
+    uint32_t capture_stalls;
+    uint32_t send_stalls;
+    uint32_t capture_failures;
+    uint32_t stream_aborts;
+    uint32_t alarm_forced_stops;
+    uint32_t recoveries;
+    uint32_t recovery_failures;
+    uint32_t last_recovery_ms;
+    uint32_t max_recovery_ms;
+    uint32_t last_alarm_stop_ms;
+    uint32_t max_alarm_stop_ms;
+};
+
+HealthStats health = {};
+volatile StreamStage stream_stage = STAGE_IDLE;
+volatile unsigned long stream_stage_since = 0;
+volatile bool camera_fault = false;         // Set on stall/failures, cleared by a reinit
+volatile bool camera_recovering = false;
+SemaphoreHandle_t camera_lock = NULL;       // Held from esp_camera_fb_get() to fb_return()
+
+// /capture hand-off: the httpd task never calls esp_camera_fb_get() itself,
+// it asks the stream task for a copy and waits at most CAPTURE_DEADLINE_MS
+SemaphoreHandle_t capture_ready = NULL;
+static portMUX_TYPE capture_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool capture_wanted = false;
+static uint8_t *capture_buf = NULL;
+static size_t capture_len = 0;
+TaskHandle_t healthTaskHandle = NULL;
+
+bool initCamera();
+
+static inline void setStreamStage(StreamStage stage) {
+    stream_stage_since = millis();
+    stream_stage = stage;
+}
+
+void requestCameraRecovery(const char *reason) {
+    if (camera_fault) return;
+    Serial.printf("🩺 Camera fault: %s — scheduling reinit\n", reason);
+    camera_fault = true;
+    if (healthTaskHandle) xTaskNotifyGive(healthTaskHandle);
+}
+
+// Drop every stream client at once. Their sessions are closed through
+// close_fn, which also shuts the socket down so a blocked send returns.
+void abortStream(const char *reason) {
+    bool any = false;
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (stream_subs.slot[i] == SLOT_ACTIVE) {
+            detachedDrop(stream_subs, i);
+            any = true;
+        }
+    }
+    if (any) health.stream_aborts++;
+    if (stream_running) {
+        Serial.printf("🩺 Stream aborted: %s\n", reason);
+        stream_running = false;
+        stream_fps = 0;
+        publishStreamEvent();
     }
+}
 
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if (res != ESP_OK) return res;
-    set_cors_headers(req);
+// Ask the stream to stop and wait at most ALARM_HANDSHAKE_MS for it, then
+// force it. Returns how long it took until the stream was no longer running.
+unsigned long stopStreamBounded() {
+    stream_must_stop = true;
+    unsigned long waitStart = millis();
+    while (stream_running && (millis() - waitStart < ALARM_HANDSHAKE_MS)) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    if (stream_running) {
+        health.alarm_forced_stops++;
+        abortStream("alarm handshake deadline");
+    }
 
-    stream_running = true;
-    stream_must_stop = false;
-    Serial.println("📹 === STREAM STARTED ===");
+    unsigned long took = millis() - waitStart;
+    health.last_alarm_stop_ms = took;
+    if (took > health.max_alarm_stop_ms) health.max_alarm_stop_ms = took;
+    return took;
+}
+
+static void recoverCamera() {
+    camera_recovering = true;
+    unsigned long start = millis();
+
+    if (xSemaphoreTake(camera_lock, pdMS_TO_TICKS(RECOVERY_LOCK_MS)) != pdTRUE) {
+        // Capture path still stuck; try again on the next round
+        Serial.println("🩺 Reinit postponed: camera still busy");
+        health.recovery_failures++;
+        camera_recovering = false;
+        return;
+    }
+
+    esp_camera_deinit();
+    bool ok = initCamera();
+    xSemaphoreGive(camera_lock);
+
+    uint32_t took = millis() - start;
+    if (ok) {
+        camera_fault = false;
+        health.recoveries++;
+        health.last_recovery_ms = took;
+        if (took > health.max_recovery_ms) health.max_recovery_ms = took;
+        Serial.printf("🩺 Camera reinitialized in %u ms (recovery #%u)\n", took, health.recoveries);
+    } else {
+        health.recovery_failures++;
+        Serial.printf("🩺 Camera reinit failed after %u ms\n", took);
+    }
+    camera_recovering = false;
+    ssePublish("health", "{\"recovered\":%s,\"recovery_ms\":%u,\"recoveries\":%u}",
+               ok ? "true" : "false", took, health.recoveries);
+}
+
+void healthTask(void * parameter) {
+    unsigned long handledSince = 0;     // Stage start already reported as a stall
+    unsigned long lastAttempt = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WATCHDOG_PERIOD_MS));
+
+        StreamStage stage = stream_stage;
+        unsigned long since = stream_stage_since;
+        unsigned long age = millis() - since;
+
+        if (stage == STAGE_CAPTURE && age > CAPTURE_DEADLINE_MS && since != handledSince) {
+            handledSince = since;
+            health.capture_stalls++;
+            requestCameraRecovery("capture stalled");
+        } else if (stage == STAGE_SEND && age > SEND_DEADLINE_MS && since != handledSince) {
+            // SO_SNDTIMEO should already have fired; this is the backstop
+            handledSince = since;
+            health.send_stalls++;
+            abortStream("send stalled");
+        }
+
+        if (camera_fault && millis() - lastAttempt >= RECOVERY_BACKOFF_MS) {
+            lastAttempt = millis();
+            recoverCamera();
+        }
+    }
+}
+
+// ======================== SENSOR PROFILES ========================
+// Named sets of sensor settings, applied at runtime without a camera
+// reinit. A switch is a burst of SCCB register writes done between two
+// frames by whoever holds camera_lock next (normally the stream task), so
+// the only cost is the frames already captured with the old settings,
+// which are dropped and counted as the switch latency.
+//
+// Profiles live in Preferences ("sensor" namespace) and are edited through
+// /control. With auto on, the stream task moves between "day" and "night"
+// on measured gain: the OV2640 only raises gain once exposure time is
+// maxed, so sustained high gain means the scene is too dark for the day
+// settings.
+#define PROFILE_MAX 6
+#define PROFILE_STORE_VERSION 1
+#define PROFILE_MAX_FRAMESIZE FRAMESIZE_VGA     // Frame buffers are sized for this at init
+#define PROFILE_NIGHT_GAIN_X16 (7 * 16)         // Enter night at 7x of the day 8x ceiling
+#define PROFILE_DAY_GAIN_X16 (2 * 16)           // Leave night once gain is back at 2x
+#define PROFILE_AUTO_HOLD_MS 3000               // Condition must hold this long
+#define PROFILE_SWITCH_MAX_DROP 4               // Never drop more than this per switch
+
+struct SensorProfile {
+    char name[16];
+    uint8_t framesize;          // framesize_t, up to PROFILE_MAX_FRAMESIZE
+    uint8_t quality;            // JPEG quality 4-63, lower = better
+    int8_t brightness;          // -2..2
+    int8_t contrast;            // -2..2
+    int8_t saturation;          // -2..2
+    int8_t ae_level;            // -2..2, AEC target
+    uint8_t awb;                // Auto white balance + AWB gain
+    uint8_t aec;                // Auto exposure; off = aec_value
+    uint8_t aec2;               // DSP night-mode AEC (longer exposures)
+    uint8_t agc;                // Auto gain; off = agc_gain
+    uint8_t gainceiling;        // gainceiling_t, AGC upper limit
+    uint8_t agc_gain;           // Manual gain 0-30
+    uint16_t aec_value;         // Manual exposure 0-1200
+    uint8_t lenc;               // Lens shading correction
+    uint8_t dcw;                // Downsize in the DSP
+};
+
+// "day" matches the settings the camera used to get at boot
+static const SensorProfile PROFILE_PRESETS[] = {
+    {"day",   FRAMESIZE_QVGA, 12, 0, 0, 0, 0, 1, 1, 0, 1, GAINCEILING_8X,  0, 300, 1, 1},
+    {"night", FRAMESIZE_QVGA, 14, 1, 1, -1, 2, 1, 1, 1, 1, GAINCEILING_64X, 0, 300, 1, 1},
+};
+
+struct ProfileStats {
+    uint32_t switches;
+    uint32_t auto_switches;
+    uint32_t last_frames_lost;  // Stale frames dropped after the last switch
+    uint32_t max_frames_lost;
+    uint32_t last_switch_ms;    // Apply → first frame with the new settings
+};
+
+SensorProfile profiles[PROFILE_MAX];
+uint8_t profile_count = 0;
+volatile int8_t profile_active = 0;
+volatile bool profile_auto = false;
+ProfileStats profile_stats = {};
+
+static portMUX_TYPE profile_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile int8_t profile_pending = -1;
+static bool profile_pending_auto = false;
+
+// Owned by whoever holds camera_lock
+static bool profile_measuring = false;
+static int64_t profile_applied_us = 0;
+static int64_t profile_timer_us = 0;        // Latency start, 0 until the next capture
+static uint16_t profile_expect_w = 0;
+static uint16_t profile_expect_h = 0;
+static uint32_t profile_dropped = 0;
+static bool profile_applied_auto = false;
+
+int findProfile(const char *name) {
+    for (int i = 0; i < profile_count; i++) {
+        if (strcmp(profiles[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void loadSensorProfiles() {
+    preferences.begin("sensor", true);
+    size_t stored = preferences.getBytesLength("table");
+    if (preferences.getUChar("ver", 0) == PROFILE_STORE_VERSION && stored > 0 &&
+        stored <= sizeof(profiles) && stored % sizeof(SensorProfile) == 0) {
+        preferences.getBytes("table", profiles, stored);
+        profile_count = stored / sizeof(SensorProfile);
+    } else {
+        memcpy(profiles, PROFILE_PRESETS, sizeof(PROFILE_PRESETS));
+        profile_count = sizeof(PROFILE_PRESETS) / sizeof(SensorProfile);
+    }
+    char active[16] = "day";
+    preferences.getString("active", active, sizeof(active));
+    profile_auto = preferences.getBool("auto", false);
+    preferences.end();
+
+    int idx = findProfile(active);
+    profile_active = idx >= 0 ? idx : 0;
+    Serial.printf("✓ Sensor profiles: %u stored, active '%s'%s\n", profile_count,
+                  profiles[profile_active].name, profile_auto ? " (auto day/night)" : "");
+}
+
+// active is passed in: a requested switch may not have reached the sensor yet
+void saveSensorProfiles(int active) {
+    preferences.begin("sensor", false);
+    preferences.putUChar("ver", PROFILE_STORE_VERSION);
+    preferences.putBytes("table", profiles, profile_count * sizeof(SensorProfile));
+    preferences.putString("active", profiles[active].name);
+    preferences.putBool("auto", profile_auto);
+    preferences.end();
+}
+
+// All writes back to back; caller holds camera_lock (or is initCamera)
+void applySensorProfile(sensor_t *s, const SensorProfile &p) {
+    if (!s) return;
+    s->set_framesize(s, (framesize_t)p.framesize);
+    s->set_quality(s, p.quality);
+    s->set_brightness(s, p.brightness);
+    s->set_contrast(s, p.contrast);
+    s->set_saturation(s, p.saturation);
+    s->set_whitebal(s, p.awb);
+    s->set_awb_gain(s, p.awb);
+    s->set_exposure_ctrl(s, p.aec);
+    s->set_aec2(s, p.aec2);
+    s->set_ae_level(s, p.ae_level);
+    if (!p.aec) s->set_aec_value(s, p.aec_value);
+    s->set_gain_ctrl(s, p.agc);
+    s->set_gainceiling(s, (gainceiling_t)p.gainceiling);
+    if (!p.agc) s->set_agc_gain(s, p.agc_gain);
+    s->set_lenc(s, p.lenc);
+    s->set_dcw(s, p.dcw);
+}
+
+// Queue a switch for the next frame boundary. Wakes the stream task; if no
+// stream is running the caller applies it itself via applyPendingProfile().
+void requestProfile(int index, bool automatic) {
+    portENTER_CRITICAL(&profile_mux);
+    profile_pending = index;
+    profile_pending_auto = automatic;
+    portEXIT_CRITICAL(&profile_mux);
+}
+
+// Call with camera_lock held, between fb_return and the next fb_get
+void applyPendingProfile() {
+    portENTER_CRITICAL(&profile_mux);
+    int index = profile_pending;
+    bool automatic = profile_pending_auto;
+    profile_pending = -1;
+    portEXIT_CRITICAL(&profile_mux);
+    if (index < 0 || index >= profile_count) return;
+
+    const SensorProfile &p = profiles[index];
+    applySensorProfile(esp_camera_sensor_get(), p);
+    profile_active = index;
+    profile_stats.switches++;
+    if (automatic) profile_stats.auto_switches++;
+
+    // Scores are relative to running averages, which a new profile resets
+    quality_size_ema = 0;
+    quality_sharp_ema = 0;
+    quality_aec = 0;
+
+    profile_measuring = true;
+    profile_applied_us = esp_timer_get_time();
+    // Applied between frames: the next capture follows right away. Applied
+    // while idle: latency starts at whichever capture comes first.
+    profile_timer_us = stream_running ? profile_applied_us : 0;
+    profile_applied_auto = automatic;
+    profile_expect_w = resolution[p.framesize].width;
+    profile_expect_h = resolution[p.framesize].height;
+    profile_dropped = 0;
+    Serial.printf("🎛️ Sensor profile '%s' applied%s\n", p.name, automatic ? " (auto)" : "");
+}
+
+// Call with camera_lock held, right before esp_camera_fb_get()
+void profileCaptureStarting() {
+    if (profile_measuring && profile_timer_us == 0) profile_timer_us = esp_timer_get_time();
+}
+
+// Frames captured before the switch, or still at the old size, carry the
+// old settings. Returns true if fb should be dropped; the first good frame
+// closes the measurement.
+bool profileFrameIsStale(const camera_fb_t *fb) {
+    if (!profile_measuring) return false;
+    int64_t captured = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    bool stale = captured < profile_applied_us ||
+                 fb->width != profile_expect_w || fb->height != profile_expect_h;
+    if (stale && profile_dropped < PROFILE_SWITCH_MAX_DROP) {
+        profile_dropped++;
+        return true;
+    }
+
+    profile_measuring = false;
+    profile_stats.last_frames_lost = profile_dropped;
+    if (profile_dropped > profile_stats.max_frames_lost) profile_stats.max_frames_lost = profile_dropped;
+    profile_stats.last_switch_ms = (esp_timer_get_time() - profile_timer_us) / 1000;
+    Serial.printf("🎛️ Profile switch settled: %u frames lost, %u ms\n",
+                  profile_stats.last_frames_lost, profile_stats.last_switch_ms);
+    ssePublish("profile", "{\"active\":\"%s\",\"auto\":%s,\"frames_lost\":%u,\"switch_ms\":%u}",
+               profiles[profile_active].name, profile_applied_auto ? "true" : "false",
+               profile_stats.last_frames_lost, profile_stats.last_switch_ms);
+    return false;
+}
+
+// Day/night hysteresis on measured gain, run by the stream task per frame
+void profileAutoSwitch(const FrameQuality &q) {
+    static unsigned long conditionSince = 0;
+    if (!profile_auto || profile_measuring || profile_pending >= 0 || q.gain_x16 == 0) {
+        conditionSince = 0;
+        return;
+    }
+    int day = findProfile("day");
+    int night = findProfile("night");
+    if (day < 0 || night < 0) return;
+
+    int target = -1;
+    if (profile_active != night && q.gain_x16 >= PROFILE_NIGHT_GAIN_X16) target = night;
+    else if (profile_active == night && q.gain_x16 <= PROFILE_DAY_GAIN_X16) target = day;
+    if (target < 0) {
+        conditionSince = 0;
+        return;
+    }
+    if (conditionSince == 0) conditionSince = millis() | 1;
+    if (millis() - conditionSince >= PROFILE_AUTO_HOLD_MS) {
+        conditionSince = 0;
+        requestProfile(target, true);
+    }
+}
+
+// ======================== STREAM TASK ========================
+// This is the critical loop. It captures each frame once and sends it to
+// every /stream client and UDP subscriber. When stream_must_stop becomes
+// true, it drops all /stream clients and pauses UDP IMMEDIATELY, freeing
+// GPIO 13 for the buzzer.
+static const char* _STREAM_BOUNDARY = "\r\n--frame\r\n";
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                                  "X-Quality: %u\r\nX-Quality-Flags: %s\r\n\r\n";
+
+static void dropAllStreamClients() {
+    for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+        if (stream_subs.slot[i] == SLOT_ACTIVE) detachedDrop(stream_subs, i);
+    }
+}
+
+// Hand /capture a copy, so the frame buffer never outlives camera_lock (a
+// reinit could free it under the httpd task). If the handler already gave
+// up, the copy is dropped.
+static void deliverCapture(const camera_fb_t *fb) {
+    uint8_t *copy = (uint8_t *)capsAlloc(fb->len, MALLOC_CAP_SPIRAM);
+    if (copy) memcpy(copy, fb->buf, fb->len);
+    portENTER_CRITICAL(&capture_mux);
+    bool wanted = capture_wanted;
+    if (wanted) {
+        capture_buf = copy;
+        capture_len = copy ? fb->len : 0;
+        capture_wanted = false;
+    }
+    portEXIT_CRITICAL(&capture_mux);
+    if (wanted) xSemaphoreGive(capture_ready);
+    else free(copy);
+}
+
+void streamTask(void * parameter) {
+    char part_buf[160];
+    char flag_buf[48];
+    unsigned long fpsWindowStart = 0;
+    int fpsFrames = 0;
+    int captureFailures = 0;
+    UdpSubscriber udpTargets[UDP_MAX_SUBSCRIBERS];
+
+    for (;;) {
+        stream_clients = detachedReap(stream_subs);
+        int udpTargetCount = udpSnapshot(udpTargets);
 
-    while (true) {
         // *** CHECK STOP FLAG FIRST — before any camera/GPIO operations ***
-        if (stream_must_stop) {
+        if (stream_must_stop && stream_clients > 0) {
             Serial.println("📹 Stream received STOP signal");
-            break;
+            dropAllStreamClients();
+            continue;
         }
 
-        fb = esp_camera_fb_get();
+        bool streaming = stream_clients > 0 || udpTargetCount > 0;
+        if (stream_must_stop || !streaming) {
+            if (stream_running) {
+                stream_running = false;
+                stream_fps = 0;
+                Serial.println("📹 === STREAM STOPPED ===");
+                publishStreamEvent();
+            }
+            if (udpTargetCount == 0 && udp_packet) udpReleaseScratch();
+            if (stream_must_stop || !capture_wanted) {
+                // Sleep until a client is added, a session closes or /capture
+                // asks for a frame. UDP subscribers have no session, so poll
+                // while any are waiting.
+                ulTaskNotifyTake(pdTRUE, udpTargetCount ? pdMS_TO_TICKS(100) : portMAX_DELAY);
+                continue;
+            }
+            // Not streaming, but /capture is waiting for one frame
+        }
+
+        if (streaming && !stream_running) {
+            stream_running = true;
+            fpsWindowStart = millis();
+            fpsFrames = 0;
+            Serial.println("📹 === STREAM STARTED ===");
+            publishStreamEvent();
+        }
+
+        // Camera is being reinitialized by the health task — keep clients, wait
+        if (camera_fault || camera_recovering) {
+            vTaskDelay(pdMS_TO_TICKS(20));
+            continue;
+        }
+
+        xSemaphoreTake(camera_lock, portMAX_DELAY);
+        applyPendingProfile();
+        profileCaptureStarting();
+        setStreamStage(STAGE_CAPTURE);
+        camera_fb_t * fb = esp_camera_fb_get();
+        unsigned long captureMs = millis();
+        setStreamStage(STAGE_IDLE);
         if (!fb) {
+            xSemaphoreGive(camera_lock);
+            health.capture_failures++;
             Serial.println("📹 Camera frame failed");
-            res = ESP_FAIL;
-            break;
+            if (++captureFailures >= CAPTURE_FAIL_LIMIT) {
+                captureFailures = 0;
+                requestCameraRecovery("repeated capture failures");
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+            continue;
         }
+        captureFailures = 0;
 
         // Check again after camera capture (capture takes time)
         if (stream_must_stop) {
             esp_camera_fb_return(fb);
+            xSemaphoreGive(camera_lock);
             Serial.println("📹 Stream received STOP signal (post-capture)");
-            break;
+            dropAllStreamClients();
+            continue;
         }
 
-        res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        if (res == ESP_OK) {
-            size_t hlen = snprintf(part_buf, 64, _STREAM_PART, fb->len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
+        if (profileFrameIsStale(fb)) {
+            esp_camera_fb_return(fb);
+            xSemaphoreGive(camera_lock);
+            continue;
         }
-        if (res == ESP_OK) {
-            res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
+
+        if (capture_wanted) deliverCapture(fb);
+        if (!streaming) {
+            esp_camera_fb_return(fb);
+            xSemaphoreGive(camera_lock);
+            continue;
         }
 
-        esp_camera_fb_return(fb);
+        FrameQuality q = scoreFrame(fb);
+        profileAutoSwitch(q);
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, fb->len,
+                               q.score, qualityFlagNames(q.flags, flag_buf, sizeof(flag_buf)));
+        for (int i = 0; i < DETACHED_MAX_CLIENTS; i++) {
+            if (stream_subs.slot[i] != SLOT_ACTIVE) continue;
+            if (q.score < stream_subs.param[i]) {
+                quality_dropped++;
+                continue;
+            }
+            int fd = stream_subs.fd[i];
+            setStreamStage(STAGE_SEND);
+            if (!sendAll(fd, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY)) ||
+                !sendAll(fd, part_buf, hlen) ||
+                !sendAll(fd, (const char *)fb->buf, fb->len)) {
+                Serial.println("📹 Stream send failed (client disconnected or stalled)");
+                detachedDrop(stream_subs, i);
+            }
+        }
+        if (udpTargetCount > 0) {
+            // Datagrams never block on the receiver, so no deadline is needed
+            udpSendFrame(fb, captureMs, q.score, udpTargets, udpTargetCount);
+        }
+        setStreamStage(STAGE_IDLE);
 
-        if (res != ESP_OK) {
-            Serial.println("📹 Stream send failed (client disconnected?)");
-            break;
+        esp_camera_fb_return(fb);
+        xSemaphoreGive(camera_lock);
+
+        fpsFrames++;
+        unsigned long fpsElapsed = millis() - fpsWindowStart;
+        if (fpsElapsed >= 1000) {
+            stream_fps = (fpsFrames * 1000 + fpsElapsed / 2) / fpsElapsed;
+            fpsFrames = 0;
+            fpsWindowStart = millis();
         }
 
         // Small yield so other tasks get CPU time
         vTaskDelay(pdMS_TO_TICKS(1));
     }
+}
+
+// ======================== STREAM HANDLER ========================
+// Only answers the HTTP request; the socket is then handed to the stream
+// task so this httpd task can keep serving /alarm and /status.
+static esp_err_t stream_handler(httpd_req_t *req) {
+    static const char* _STREAM_HEADER =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: multipart/x-mixed-replace;boundary=frame\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+    // Don't allow stream to start if alarm is active
+    if (deviceState == STATE_ALARM_ACTIVE) {
+        set_cors_headers(req);
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_send(req, "Stream paused: alarm active", 27);
+        return ESP_OK;
+    }
 
-    stream_running = false;
-    Serial.println("📹 === STREAM STOPPED ===");
+    if (!detachedHasRoom(stream_subs)) {
+        set_cors_headers(req);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_send(req, "Too many stream clients", 23);
+        return ESP_OK;
+    }
 
-    return res;
+    // Optional ?min_quality=N (0-100): frames scoring lower are not sent
+    int minQuality = 0;
+    char query[64], value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "min_quality", value, sizeof(value)) == ESP_OK) {
+        minQuality = constrain(atoi(value), 0, 100);
+    }
+
+    int fd = httpd_req_to_sockfd(req);
+    // A client that stops reading can hold a frame for at most this long
+    struct timeval sendTimeout = {SEND_DEADLINE_MS / 1000, (SEND_DEADLINE_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    if (!sendAll(fd, _STREAM_HEADER, strlen(_STREAM_HEADER))) return ESP_FAIL;
+    detachedAdd(stream_subs, fd, minQuality);
+
+    stream_must_stop = false;
+    xTaskNotifyGive(streamTaskHandle);
+    return ESP_OK;
+}
+
+// ======================== EVENTS HANDLER ========================
+// Server-Sent Events feed: state/stream transitions as they happen, plus a
+// telemetry heartbeat. Replaces polling /status.
+static esp_err_t events_handler(httpd_req_t *req) {
+    static const char* _EVENTS_HEADER =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+
+    int fd = httpd_req_to_sockfd(req);
+    if (!detachedHasRoom(sse_subs)) {
+        set_cors_headers(req);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_send(req, "Too many event subscribers", 26);
+        return ESP_OK;
+    }
+
+    // Header plus a snapshot so the subscriber starts from the current state
+    bool alarming = (deviceState == STATE_ALARM_ACTIVE);
+    char hello[256];
+    int len = snprintf(hello, sizeof(hello),
+                       "retry: %d\n\n"
+                       "event: state\ndata: {\"device_state\":\"%s\",\"alarm_active\":%s,\"alerts\":%d}\n\n"
+                       "event: stream\ndata: {\"stream_running\":%s,\"clients\":%d}\n\n",
+                       SSE_RETRY_MS, alarming ? "ALARM_ACTIVE" : "MONITORING",
+                       alarming ? "true" : "false", total_drowsiness_alerts,
+                       stream_running ? "true" : "false", stream_clients);
+    if (!sendAll(fd, _EVENTS_HEADER, strlen(_EVENTS_HEADER)) || !sendAll(fd, hello, len)) {
+        return ESP_FAIL;
+    }
+    detachedAdd(sse_subs, fd);
+    Serial.println("📣 SSE subscriber connected");
+    return ESP_OK;
 }
 
 // ======================== CAPTURE HANDLER ========================
+// The frame comes from the stream task, which owns the capture path and
+// its stage deadlines; this task only waits CAPTURE_DEADLINE_MS for it, so
+// a stuck camera can't hold up /alarm behind a /capture.
 static esp_err_t capture_handler(httpd_req_t *req) {
     // Single frame capture - also blocked during alarm
     if (deviceState == STATE_ALARM_ACTIVE) {
@@ -447,58 +1890,72 @@ static esp_err_t capture_handler(httpd_req_t *req) {
         return ESP_OK;
     }
 
-    camera_fb_t * fb = esp_camera_fb_get();
-    if (!fb) return ESP_FAIL;
+    if (camera_fault || camera_recovering) {
+        set_cors_headers(req);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, "{\"error\":\"camera_recovering\"}", 29);
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(capture_ready, 0);      // Stale signal from a request that timed out
+    portENTER_CRITICAL(&capture_mux);
+    capture_wanted = true;
+    portEXIT_CRITICAL(&capture_mux);
+    xTaskNotifyGive(streamTaskHandle);
+    xSemaphoreTake(capture_ready, pdMS_TO_TICKS(CAPTURE_DEADLINE_MS));
+
+    portENTER_CRITICAL(&capture_mux);
+    uint8_t *jpeg = capture_buf;
+    size_t len = capture_len;
+    capture_buf = NULL;
+    capture_wanted = false;
+    portEXIT_CRITICAL(&capture_mux);
+
     set_cors_headers(req);
+    if (!jpeg) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, "{\"error\":\"camera_busy\"}", 23);
+        return ESP_OK;
+    }
     httpd_resp_set_type(req, "image/jpeg");
-    esp_err_t res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
+    esp_err_t res = httpd_resp_send(req, (const char *)jpeg, len);
+    free(jpeg);
     return res;
 }
 
 // ======================== ALARM HANDLER ========================
+// Body and JSON stay on the stack: /alarm must work even if the request
+// arena could not be allocated
 static esp_err_t alarm_handler(httpd_req_t *req) {
     char content[200];
-    int ret = httpd_req_recv(req, content, sizeof(content));
-    if (ret <= 0) {
+    if (!recvBody(req, content, sizeof(content))) {
         Serial.println("❌ Alarm: no body received");
         return ESP_FAIL;
     }
-    content[ret] = '\0';
 
-    DynamicJsonDocument doc(512);
+    StaticJsonDocument<256> doc;
     DeserializationError error = deserializeJson(doc, content);
     if (error) {
         Serial.printf("❌ Alarm: JSON error: %s\n", error.c_str());
         return ESP_FAIL;
     }
 
-    String command = doc["command"];
+    const char *command = doc["command"] | "";
     set_cors_headers(req);
-    httpd_resp_set_type(req, "application/json");
 
-    if (command == "ALARM_ON") {
+    if (strcmp(command, "ALARM_ON") == 0) {
         Serial.println("\n🚨🚨🚨 ALARM_ON RECEIVED 🚨🚨🚨");
 
-        // STEP 1: Signal stream to stop
-        stream_must_stop = true;
+        // STEP 1+2: Signal stream to stop and wait for it
+        // The stream checks stream_must_stop every frame (~30-50ms); if it
+        // hasn't stopped within ALARM_HANDSHAKE_MS it is aborted, so the
+        // buzzer never waits longer than that
         Serial.println("   → stream_must_stop = true");
-
-        // STEP 2: Wait for stream to actually stop
-        // The stream checks stream_must_stop every frame (~30-50ms)
-        // We give it up to 3 seconds
-        unsigned long waitStart = millis();
-        while (stream_running && (millis() - waitStart < 3000)) {
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-
-        if (stream_running) {
-            Serial.println("   ⚠️ Stream didn't stop in 3s — forcing state anyway");
-            // Even if stream is stuck, we set state so buzzer task
-            // will activate the moment it does stop
-        } else {
-            Serial.printf("   ✅ Stream stopped in %lu ms\n", millis() - waitStart);
-        }
+        unsigned long took = stopStreamBounded();
+        Serial.printf("   ✅ Stream stopped in %lu ms%s\n", took,
+                      took >= ALARM_HANDSHAKE_MS ? " (forced)" : "");
 
         // STEP 3: Transition to alarm state
         // The buzzer task on Core 0 will see this and start buzzing
@@ -508,12 +1965,13 @@ static esp_err_t alarm_handler(httpd_req_t *req) {
         alarm_start_time = millis();
 
         Serial.printf("   🔊 Alarm ACTIVE (alert #%d)\n", total_drowsiness_alerts);
+        publishStateEvent();
         Serial.println("   📹 Stream stopped → GPIO 13 free → Buzzer task will buzz\n");
 
-        String response = "{\"status\":\"ok\",\"alarm_active\":true,\"stream_stopped\":true,\"alerts\":" + String(total_drowsiness_alerts) + "}";
-        return httpd_resp_send(req, response.c_str(), response.length());
+        return sendJsonf(req, "{\"status\":\"ok\",\"alarm_active\":true,\"stream_stopped\":true,\"alerts\":%d}",
+                         total_drowsiness_alerts);
 
-    } else if (command == "ALARM_OFF") {
+    } else if (strcmp(command, "ALARM_OFF") == 0) {
         Serial.println("\n🔇🔇🔇 ALARM_OFF RECEIVED 🔇🔇🔇");
 
         // STEP 1: Deactivate alarm — buzzer task will stop buzzing
@@ -525,15 +1983,15 @@ static esp_err_t alarm_handler(httpd_req_t *req) {
         digitalWrite(BUZZER_PIN, LOW);
 
         Serial.println("   🔇 Buzzer OFF");
+        publishStateEvent();
         Serial.println("   📹 App/browser can reconnect to /stream now\n");
 
-        String response = "{\"status\":\"ok\",\"alarm_active\":false,\"stream_stopped\":false,\"alerts\":" + String(total_drowsiness_alerts) + "}";
-        return httpd_resp_send(req, response.c_str(), response.length());
+        return sendJsonf(req, "{\"status\":\"ok\",\"alarm_active\":false,\"stream_stopped\":false,\"alerts\":%d}",
+                         total_drowsiness_alerts);
 
     } else {
-        Serial.printf("⚠️ Unknown alarm command: '%s'\n", command.c_str());
-        String response = "{\"status\":\"error\",\"message\":\"unknown command\"}";
-        return httpd_resp_send(req, response.c_str(), response.length());
+        Serial.printf("⚠️ Unknown alarm command: '%s'\n", command);
+        return sendJsonf(req, "{\"status\":\"error\",\"message\":\"unknown command\"}");
     }
 }
 
@@ -544,12 +2002,8 @@ static esp_err_t test_alarm_handler(httpd_req_t *req) {
     Serial.println("\n🧪 TEST ALARM — stopping stream first...");
 
     // Stop stream
-    stream_must_stop = true;
-    unsigned long waitStart = millis();
-    while (stream_running && (millis() - waitStart < 3000)) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-    }
-    Serial.printf("   Stream stopped: %s\n", stream_running ? "NO (timeout)" : "YES");
+    unsigned long took = stopStreamBounded();
+    Serial.printf("   Stream stopped in %lu ms\n", took);
 
     // Reclaim pin and test
     pinMode(BUZZER_PIN, OUTPUT);
@@ -565,41 +2019,273 @@ static esp_err_t test_alarm_handler(httpd_req_t *req) {
     stream_must_stop = false;
     Serial.println("🧪 Test done — stream can reconnect\n");
 
-    String response = "{\"test\":\"completed\",\"buzzer_pin\":" + String(BUZZER_PIN) + ",\"beeps\":3}";
-    httpd_resp_set_type(req, "application/json");
-    return httpd_resp_send(req, response.c_str(), response.length());
+    return sendJsonf(req, "{\"test\":\"completed\",\"buzzer_pin\":%d,\"beeps\":3}", BUZZER_PIN);
 }
 
 // ======================== STATUS HANDLER ========================
+static void appendPoolStats(TextBuffer &t, const BlockPool &p, bool first) {
+    textAppend(t, "%s{\"name\":\"%s\",\"block\":%u,\"blocks\":%u,\"in_use\":%u,"
+               "\"high_water\":%u,\"failures\":%u}",
+               first ? "" : ",", p.name, p.block_size, p.blocks, p.in_use,
+               p.high_water, p.failures);
+}
+
 static esp_err_t status_handler(httpd_req_t *req) {
+    arenaReset(request_arena);
     set_cors_headers(req);
 
-    String stateStr = (deviceState == STATE_ALARM_ACTIVE) ? "ALARM_ACTIVE" : "MONITORING";
-
-    String json = "{";
-    json += "\"status\":\"online\",";
-    json += "\"device_state\":\"" + stateStr + "\",";
-    json += "\"alarm_active\":" + String(deviceState == STATE_ALARM_ACTIVE ? "true" : "false") + ",";
-    json += "\"stream_running\":" + String(stream_running ? "true" : "false") + ",";
-    json += "\"alerts\":" + String(total_drowsiness_alerts) + ",";
-    json += "\"wifi_ssid\":\"" + WiFi.SSID() + "\",";
-    json += "\"ip\":\"" + WiFi.localIP().toString() + "\",";
-    json += "\"rssi\":" + String(WiFi.RSSI()) + ",";
-    json += "\"buzzer_pin\":" + String(BUZZER_PIN) + ",";
-    json += "\"free_heap\":" + String(ESP.getFreeHeap());
-    json += "}";
+    TextBuffer json;
+    if (!textInit(json, 2048)) return httpd_resp_send_500(req);
+
+    bool alarm = deviceState == STATE_ALARM_ACTIVE;
+    textAppend(json, "{\"status\":\"online\",\"device_state\":\"%s\",\"alarm_active\":%s,"
+               "\"stream_running\":%s,\"alerts\":%d,\"wifi_ssid\":\"",
+               alarm ? "ALARM_ACTIVE" : "MONITORING", alarm ? "true" : "false",
+               stream_running ? "true" : "false", total_drowsiness_alerts);
+    textAppendEscaped(json, saved_ssid);
+    textAppend(json, "\",\"ip\":\"");
+    textAppendIP(json, WiFi.localIP());
+    textAppend(json, "\",\"rssi\":%d,\"buzzer_pin\":%d,\"free_heap\":%u,",
+               WiFi.RSSI(), BUZZER_PIN, ESP.getFreeHeap());
+
+    textAppend(json, "\"quality\":{\"score\":%u,\"flags\":%u,\"size_pct\":%u,\"sharp_pct\":%u,"
+               "\"aec\":%u,\"gain_x16\":%u,\"dropped\":%u},",
+               last_quality.score, last_quality.flags, last_quality.size_pct,
+               last_quality.sharp_pct, last_quality.aec, last_quality.gain_x16, quality_dropped);
+
+    textAppend(json, "\"udp\":{\"subscribers\":%d,\"frames_sent\":%u,\"send_errors\":%u},",
+               udp_stream_clients, udp_frames_sent, udp_send_errors);
+
+    textAppend(json, "\"health\":{\"camera_fault\":%s,\"capture_stalls\":%u,\"send_stalls\":%u,"
+               "\"capture_failures\":%u,\"stream_aborts\":%u,\"alarm_forced_stops\":%u,"
+               "\"recoveries\":%u,\"recovery_failures\":%u,\"last_recovery_ms\":%u,"
+               "\"max_recovery_ms\":%u,\"last_alarm_stop_ms\":%u,\"max_alarm_stop_ms\":%u},",
+               camera_fault ? "true" : "false", health.capture_stalls, health.send_stalls,
+               health.capture_failures, health.stream_aborts, health.alarm_forced_stops,
+               health.recoveries, health.recovery_failures, health.last_recovery_ms,
+               health.max_recovery_ms, health.last_alarm_stop_ms, health.max_alarm_stop_ms);
+
+    textAppend(json, "\"profile\":{\"active\":\"%s\",\"auto\":%s,\"switches\":%u,"
+               "\"auto_switches\":%u,\"last_frames_lost\":%u,\"max_frames_lost\":%u,"
+               "\"last_switch_ms\":%u},",
+               profiles[profile_active].name, profile_auto ? "true" : "false",
+               profile_stats.switches, profile_stats.auto_switches, profile_stats.last_frames_lost,
+               profile_stats.max_frames_lost, profile_stats.last_switch_ms);
+
+    // Largest free block vs free total is the fragmentation signal: plenty
+    // free but no large block means long-running allocations are failing soon
+    const uint32_t internal = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    textAppend(json, "\"memory\":{\"internal_free\":%u,\"internal_largest\":%u,"
+               "\"internal_min_free\":%u,\"psram_free\":%u,\"psram_largest\":%u,\"pools\":[",
+               heap_caps_get_free_size(internal), heap_caps_get_largest_free_block(internal),
+               heap_caps_get_minimum_free_size(internal),
+               heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+               heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+    appendPoolStats(json, event_pool, true);
+    appendPoolStats(json, bulk_pool, false);
+    textAppend(json, "],\"arenas\":[{\"name\":\"%s\",\"capacity\":%u,\"high_water\":%u,"
+               "\"failures\":%u}]}}",
+               request_arena.name, request_arena.capacity, request_arena.high_water,
+               request_arena.failures);
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json.buf, json.len);
+}
+
+// ======================== CONTROL HANDLER ========================
+// GET  /control → profiles, active profile, auto flag, switch stats
+// POST /control → any of, validated together and then applied in this order
+// (an invalid field rejects the whole request with nothing changed):
+//   {"delete":"tunnel"}
+//   {"save":{"name":"tunnel","brightness":1,"gainceiling":5,...}}
+//        (missing fields keep their stored value, or the active profile's
+//         for a new name)
+//   {"auto":true}
+//   {"profile":"night"}   (turns auto off unless "auto" is also given)
+// Table edits, the active profile and the auto flag are persisted; the
+// switch itself happens at the next frame boundary.
+static bool validProfileName(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(SensorProfile::name)) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') return false;
+    }
+    return true;
+}
+
+// Switches accept true/false as well as 0/1
+static uint8_t jsonFlag(JsonVariantConst v, uint8_t current) {
+    return v.isNull() ? current : (v.as<bool>() ? 1 : 0);
+}
+
+static void profileFromJson(SensorProfile &p, JsonObjectConst o) {
+    p.framesize = o["framesize"] | p.framesize;
+    p.quality = constrain(o["quality"] | (int)p.quality, 4, 63);
+    p.brightness = constrain(o["brightness"] | (int)p.brightness, -2, 2);
+    p.contrast = constrain(o["contrast"] | (int)p.contrast, -2, 2);
+    p.saturation = constrain(o["saturation"] | (int)p.saturation, -2, 2);
+    p.ae_level = constrain(o["ae_level"] | (int)p.ae_level, -2, 2);
+    p.awb = jsonFlag(o["awb"], p.awb);
+    p.aec = jsonFlag(o["aec"], p.aec);
+    p.aec2 = jsonFlag(o["aec2"], p.aec2);
+    p.agc = jsonFlag(o["agc"], p.agc);
+    p.gainceiling = constrain(o["gainceiling"] | (int)p.gainceiling, GAINCEILING_2X, GAINCEILING_128X);
+    p.agc_gain = constrain(o["agc_gain"] | (int)p.agc_gain, 0, 30);
+    p.aec_value = constrain(o["aec_value"] | (int)p.aec_value, 0, 1200);
+    p.lenc = jsonFlag(o["lenc"], p.lenc);
+    p.dcw = jsonFlag(o["dcw"], p.dcw);
+}
+
+static void appendControlState(TextBuffer &t) {
+    textAppend(t, "{\"active\":\"%s\",\"auto\":%s,\"switches\":%u,\"auto_switches\":%u,"
+               "\"last_frames_lost\":%u,\"max_frames_lost\":%u,\"last_switch_ms\":%u,\"profiles\":[",
+               profiles[profile_active].name, profile_auto ? "true" : "false",
+               profile_stats.switches, profile_stats.auto_switches, profile_stats.last_frames_lost,
+               profile_stats.max_frames_lost, profile_stats.last_switch_ms);
+    for (int i = 0; i < profile_count; i++) {
+        const SensorProfile &p = profiles[i];
+        textAppend(t, "%s{\"name\":\"%s\",\"framesize\":%u,\"quality\":%u,\"brightness\":%d,"
+                   "\"contrast\":%d,\"saturation\":%d,\"ae_level\":%d,\"awb\":%u,\"aec\":%u,"
+                   "\"aec2\":%u,\"agc\":%u,\"gainceiling\":%u,\"agc_gain\":%u,\"aec_value\":%u,"
+                   "\"lenc\":%u,\"dcw\":%u}",
+                   i ? "," : "", p.name, p.framesize, p.quality, p.brightness, p.contrast,
+                   p.saturation, p.ae_level, p.awb, p.aec, p.aec2, p.agc, p.gainceiling,
+                   p.agc_gain, p.aec_value, p.lenc, p.dcw);
+    }
+    textAppend(t, "]}");
+}
 
+static esp_err_t sendControlState(httpd_req_t *req) {
+    TextBuffer json;
+    if (!textInit(json, 2048)) return httpd_resp_send_500(req);
+    appendControlState(json);
     httpd_resp_set_type(req, "application/json");
-    return httpd_resp_send(req, json.c_str(), json.length());
+    return httpd_resp_send(req, json.buf, json.len);
+}
+
+static esp_err_t controlError(httpd_req_t *req, const char *message) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    return sendJsonf(req, "{\"status\":\"error\",\"message\":\"%s\"}", message);
+}
+
+static esp_err_t control_get_handler(httpd_req_t *req) {
+    arenaReset(request_arena);
+    set_cors_headers(req);
+    return sendControlState(req);
+}
+
+static esp_err_t control_post_handler(httpd_req_t *req) {
+    arenaReset(request_arena);
+    set_cors_headers(req);
+    char *content = readRequestBody(req);
+    if (!content) return controlError(req, "missing or oversized body");
+    RequestJsonDocument doc(768);
+    if (deserializeJson(doc, content)) return controlError(req, "invalid JSON");
+
+    // The stream task reads the table while it holds camera_lock
+    if (xSemaphoreTake(camera_lock, pdMS_TO_TICKS(CAPTURE_DEADLINE_MS)) != pdTRUE) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return sendJsonf(req, "{\"status\":\"error\",\"message\":\"camera busy\"}");
+    }
+
+    // Validate the whole request before touching anything, so it either
+    // takes effect as one batch or not at all
+    const char *error = NULL;
+    int active = profile_active;
+
+    const char *del = doc["delete"] | (const char *)NULL;
+    int delIdx = -1;
+    if (del) {
+        delIdx = findProfile(del);
+        if (delIdx < 0) error = "unknown profile";
+        else if (delIdx == active) error = "cannot delete the active profile";
+        else if (!strcmp(del, "day") || !strcmp(del, "night")) error = "day and night are required";
+    }
+
+    JsonObjectConst save = doc["save"].as<JsonObjectConst>();
+    SensorProfile saved = {};
+    const char *saveName = NULL;
+    if (!error && !save.isNull()) {
+        saveName = save["name"] | "";
+        int idx = findProfile(saveName);
+        if (idx == delIdx) idx = -1;                    // Deleted then re-created
+        int count = profile_count - (delIdx >= 0 ? 1 : 0);
+        if (!validProfileName(saveName)) error = "invalid profile name";
+        else if (idx < 0 && count >= PROFILE_MAX) error = "profile table full";
+        else if ((save["framesize"] | 0) > PROFILE_MAX_FRAMESIZE) error = "framesize above VGA";
+        else {
+            saved = profiles[idx >= 0 ? idx : active];
+            strlcpy(saved.name, saveName, sizeof(saved.name));
+            profileFromJson(saved, save);
+        }
+    }
+
+    const char *name = doc["profile"] | (const char *)NULL;
+    if (!error && name) {
+        int idx = findProfile(name);
+        bool exists = (idx >= 0 && idx != delIdx) || (saveName && !strcmp(name, saveName));
+        if (!exists) error = "unknown profile";
+    }
+
+    if (error) {
+        xSemaphoreGive(camera_lock);
+        return controlError(req, error);
+    }
+
+    // Everything checks out: apply delete, save, auto, profile in that order
+    bool changed = false;
+    int apply = -1;
+
+    if (delIdx >= 0) {
+        memmove(&profiles[delIdx], &profiles[delIdx + 1],
+                (profile_count - delIdx - 1) * sizeof(SensorProfile));
+        profile_count--;
+        if (profile_active > delIdx) profile_active--;
+        portENTER_CRITICAL(&profile_mux);
+        if (profile_pending == delIdx) profile_pending = -1;
+        else if (profile_pending > delIdx) profile_pending--;
+        portEXIT_CRITICAL(&profile_mux);
+        changed = true;
+    }
+
+    if (saveName) {
+        int idx = findProfile(saveName);
+        if (idx < 0) idx = profile_count++;
+        profiles[idx] = saved;
+        if (idx == profile_active) apply = idx;     // Edits to the live profile take effect now
+        changed = true;
+    }
+
+    if (doc.containsKey("auto")) {
+        profile_auto = doc["auto"].as<bool>();
+        changed = true;
+    }
+
+    if (name) {
+        apply = findProfile(name);
+        if (!doc.containsKey("auto")) profile_auto = false;
+        changed = true;
+    }
+
+    if (apply >= 0) {
+        requestProfile(apply, false);
+        // An idle camera has no frame boundary to wait for
+        if (!stream_running) applyPendingProfile();
+    }
+    // Persist the requested profile even if the stream applies it a frame later
+    int persist = apply >= 0 ? apply : profile_active;
+    xSemaphoreGive(camera_lock);
+
+    if (changed) saveSensorProfiles(persist);
+    return sendControlState(req);
 }
 
 // ====================== RESET HANDLER ======================
 static esp_err_t reset_handler(httpd_req_t *req) {
     set_cors_headers(req);
     clearWiFiCredentials();
-    String response = "{\"success\":true,\"message\":\"Restarting...\"}";
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, response.c_str(), response.length());
+    httpd_resp_sendstr(req, "{\"success\":true,\"message\":\"Restarting...\"}");
     delay(1000);
     ESP.restart();
     return ESP_OK;
@@ -610,7 +2296,15 @@ void startCameraServer() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
     config.ctrl_port = 32768;
-    config.max_uri_handlers = 10;
+    config.max_uri_handlers = 12;
+    config.close_fn = camera_sock_close;
+    // Up to 2 * DETACHED_MAX_CLIENTS sessions stay open for /stream and
+    // /events; keep 4 more for /alarm and friends. lwIP has 16 sockets:
+    // 10 sessions + httpd listen/ctrl + discovery and UDP stream = 14.
+    config.max_open_sockets = 2 * DETACHED_MAX_CLIENTS + 4;
+    // If it still fills up, a new request evicts the oldest session
+    // (normally a detached viewer) rather than being refused
+    config.lru_purge_enable = true;
 
     httpd_uri_t index_uri     = {"/",           HTTP_GET,  index_handler,      NULL};
     httpd_uri_t stream_uri    = {"/stream",     HTTP_GET,  stream_handler,     NULL};
@@ -618,7 +2312,10 @@ void startCameraServer() {
     httpd_uri_t alarm_uri     = {"/alarm",      HTTP_POST, alarm_handler,      NULL};
     httpd_uri_t test_uri      = {"/test_alarm", HTTP_GET,  test_alarm_handler, NULL};
     httpd_uri_t status_uri    = {"/status",     HTTP_GET,  status_handler,     NULL};
+    httpd_uri_t events_uri    = {"/events",     HTTP_GET,  events_handler,     NULL};
     httpd_uri_t reset_uri     = {"/reset",      HTTP_POST, reset_handler,      NULL};
+    httpd_uri_t control_get   = {"/control",    HTTP_GET,  control_get_handler,  NULL};
+    httpd_uri_t control_post  = {"/control",    HTTP_POST, control_post_handler, NULL};
 
     if (httpd_start(&camera_httpd, &config) == ESP_OK) {
         httpd_register_uri_handler(camera_httpd, &index_uri);
@@ -627,7 +2324,10 @@ void startCameraServer() {
         httpd_register_uri_handler(camera_httpd, &alarm_uri);
         httpd_register_uri_handler(camera_httpd, &test_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
+        httpd_register_uri_handler(camera_httpd, &events_uri);
         httpd_register_uri_handler(camera_httpd, &reset_uri);
+        httpd_register_uri_handler(camera_httpd, &control_get);
+        httpd_register_uri_handler(camera_httpd, &control_post);
 
         Serial.println("✅ Server started:");
         Serial.println("   GET  /           → Web UI");
@@ -636,7 +2336,10 @@ void startCameraServer() {
         Serial.println("   POST /alarm      → {\"command\":\"ALARM_ON\"} or {\"command\":\"ALARM_OFF\"}");
         Serial.println("   GET  /test_alarm → Test buzzer (3 beeps)");
         Serial.println("   GET  /status     → Device status JSON");
+        Serial.println("   GET  /events     → Server-Sent Events (state, stream, telemetry)");
         Serial.println("   POST /reset      → Clear WiFi & restart in AP mode");
+        Serial.println("   GET  /control    → Sensor profiles");
+        Serial.println("   POST /control    → {\"profile\":\"night\"}, {\"auto\":true}, {\"save\":{...}}");
     }
 }
 
@@ -658,7 +2361,7 @@ void startConfigServer() {
 }
 
 // ======================== INIT CAMERA ========================
-void initCamera() {
+bool initCamera() {
     camera_config_t config;
     config.ledc_channel = LEDC_CHANNEL_0;
     config.ledc_timer = LEDC_TIMER_0;
@@ -680,28 +2383,21 @@ void initCamera() {
     config.pin_reset = RESET_GPIO_NUM;
     config.xclk_freq_hz = 20000000;
     config.pixel_format = PIXFORMAT_JPEG;
-    config.frame_size = FRAMESIZE_QVGA;
+    config.frame_size = PROFILE_MAX_FRAMESIZE;     // Profiles switch down from here
     config.jpeg_quality = 12;
     config.fb_count = 2;
 
     esp_err_t err = esp_camera_init(&config);
     if (err != ESP_OK) {
         Serial.printf("❌ Camera init failed: 0x%x\n", err);
-        return;
+        return false;
     }
 
-    sensor_t * s = esp_camera_sensor_get();
-    s->set_brightness(s, 0);
-    s->set_contrast(s, 0);
-    s->set_saturation(s, 0);
-    s->set_whitebal(s, 1);
-    s->set_awb_gain(s, 1);
-    s->set_exposure_ctrl(s, 1);
-    s->set_gain_ctrl(s, 1);
-    s->set_lenc(s, 1);
-    s->set_dcw(s, 1);
+    // Also restores the active profile after a watchdog reinit
+    applySensorProfile(esp_camera_sensor_get(), profiles[profile_active]);
 
-    Serial.println("✓ Camera initialized");
+    Serial.printf("✓ Camera initialized (profile '%s')\n", profiles[profile_active].name);
+    return true;
 }
 
 // ======================== SETUP ========================
@@ -741,17 +2437,38 @@ void setup() {
         0               // Core 0 (separate from camera/HTTP on Core 1)
     );
 
+    setupCpuLoad();
+    memoryInit();
+
+    // Stream and SSE workers own the detached /stream and /events sockets;
+    // the health task watches the stream and reinitializes a stuck camera
+    camera_lock = xSemaphoreCreateMutex();
+    capture_ready = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(healthTask, "HealthTask", 4096, NULL, 4, &healthTaskHandle, 0);
+    sseQueue = xQueueCreate(SSE_QUEUE_LEN, sizeof(SseEvent *));
+    xTaskCreatePinnedToCore(sseTask, "SseTask", 3072, NULL, 2, NULL, 0);
+    xTaskCreatePinnedToCore(
+        streamTask,
+        "StreamTask",
+        4096,
+        NULL,
+        5,              // Same priority as the httpd task it replaces
+        &streamTaskHandle,
+        1               // Core 1 (camera/HTTP)
+    );
+
 #if defined(RESET_BUTTON_PIN) && RESET_BUTTON_PIN >= 0
     pinMode(RESET_BUTTON_PIN, INPUT_PULLUP);
 #endif
 
+    loadSensorProfiles();
     initCamera();
 
     if (loadWiFiCredentials()) {
-        Serial.printf("✓ Saved WiFi: %s — connecting...\n", saved_ssid.c_str());
+        Serial.printf("✓ Saved WiFi: %s — connecting...\n", saved_ssid);
 
         WiFi.mode(WIFI_STA);
-        WiFi.begin(saved_ssid.c_str(), saved_password.c_str());
+        WiFi.begin(saved_ssid, saved_password);
 
         unsigned long startAttempt = millis();
         while (WiFi.status() != WL_CONNECTED && millis() - startAttempt < WIFI_TIMEOUT) {
@@ -798,6 +2515,18 @@ void setup() {
 void loop() {
     handleUDPDiscovery();
 
+    // Keep the prebuilt discovery descriptor current and announce it
+    static unsigned long lastRefresh = 0;
+    static unsigned long lastAnnounce = 0;
+    if (millis() - lastRefresh >= DISCOVERY_REFRESH_MS) {
+        lastRefresh = millis();
+        refreshDiscoveryDescriptor();
+    }
+    if (millis() - lastAnnounce >= DISCOVERY_ANNOUNCE_MS) {
+        lastAnnounce = millis();
+        announceDiscovery();
+    }
+
     // Reset button check
     #if defined(RESET_BUTTON_PIN) && RESET_BUTTON_PIN >= 0
     static unsigned long buttonPressTime = 0;
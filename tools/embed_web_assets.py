@@ -0,0 +1,97 @@
+"""Minify and gzip the pages in web/ into src/web_assets.h.
+
+Runs automatically before every PlatformIO build (see extra_scripts in
+platformio.ini) and can also be run by hand:
+
+    python3 tools/embed_web_assets.py
+
+Each page becomes a flash-resident byte array plus a WebAsset entry with its
+precomputed length, ETag and content type. The header is only rewritten when
+its content changes, so unchanged pages don't trigger a rebuild.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+ASSETS = [
+    # (source file in web/, C identifier, content type)
+    ("setup.html", "setup_html", "text/html"),
+    ("camera.html", "camera_html", "text/html"),
+]
+
+
+def minify_html(text):
+    # Conservative: drop comments, indentation and blank lines, but keep line
+    # breaks so inline JavaScript never depends on semicolon insertion.
+    text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def to_c_array(data, indent="    ", per_line=16):
+    rows = []
+    for i in range(0, len(data), per_line):
+        rows.append(indent + ", ".join("0x%02x" % b for b in data[i:i + per_line]) + ",")
+    return "\n".join(rows)
+
+
+def render(project_dir):
+    out = [
+        "// Generated by tools/embed_web_assets.py from web/ — do not edit.",
+        "#pragma once",
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        "struct WebAsset {",
+        "    const uint8_t *data;    // gzip-compressed",
+        "    size_t len;",
+        "    const char *etag;",
+        "    const char *type;",
+        "};",
+        "",
+    ]
+    report = []
+    for src, ident, ctype in ASSETS:
+        with open(os.path.join(project_dir, "web", src), encoding="utf-8") as f:
+            raw = f.read()
+        minified = minify_html(raw).encode("utf-8")
+        # mtime=0 keeps the output (and so the ETag) reproducible
+        packed = gzip.compress(minified, compresslevel=9, mtime=0)
+        etag = '\\"%s\\"' % hashlib.sha256(packed).hexdigest()[:16]
+        out += [
+            "// web/%s: %d -> %d bytes minified -> %d bytes gzip"
+            % (src, len(raw.encode("utf-8")), len(minified), len(packed)),
+            "static const uint8_t %s_gz[] PROGMEM = {" % ident,
+            to_c_array(packed),
+            "};",
+            "static const WebAsset %s_asset = {%s_gz, sizeof(%s_gz), \"%s\", \"%s\"};"
+            % (ident, ident, ident, etag, ctype),
+            "",
+        ]
+        report.append("%s: %d -> %d bytes" % (src, len(raw.encode("utf-8")), len(packed)))
+    return "\n".join(out), report
+
+
+def generate(project_dir):
+    header, report = render(project_dir)
+    target = os.path.join(project_dir, "src", "web_assets.h")
+    try:
+        with open(target, encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    except FileNotFoundError:
+        pass
+    with open(target, "w", encoding="utf-8") as f:
+        f.write(header)
+    print("embed_web_assets: " + ", ".join(report))
+
+
+try:
+    Import("env")  # noqa: F821 -- provided by PlatformIO's SCons environment
+    generate(env["PROJECT_DIR"])  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -0,0 +1,377 @@
+// ======================== UDP FRAME RECEIVER ========================
+// Linux reference receiver for the UDP frame transport (include/udp_frame.h).
+// Subscribes to a device, reassembles frames, never waits for lost
+// fragments, and prints loss and staleness once per second.
+//
+// Build:  g++ -O2 -std=c++17 -Iinclude -o udp_receiver tools/udp_receiver.cpp
+// Run:    ./udp_receiver <device-ip> [--port 5600] [--fec 4] [--out latest.jpg]
+//                                    [--seconds N]
+//
+// Staleness is how old a frame is when it completes, on the receiver's
+// clock. Device and host clocks are unrelated, so the smallest
+// (arrival - capture timestamp) seen so far is taken as the fixed offset and
+// staleness is measured relative to it: one-way delay beyond the best case.
+//
+// Frame IDs restart when the device reboots or treats us as a new
+// subscriber. A frame far behind the last completed one, or a subscription
+// reply after the old one had lapsed, starts a new session: pending frames
+// and the clock offset are dropped instead of ignoring every later packet.
+//
+// An incomplete frame is given up on (and counted as lost right then) once a
+// newer frame completes, once it falls kMaxPendingBehind IDs behind the
+// newest ID seen, or kPendingTimeoutMs after its first fragment, so a bad
+// link shows its loss every second and pending frames can't pile up.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "udp_frame.h"
+
+namespace {
+
+// Late fragments of frames up to this far behind are ignored as stragglers;
+// anything further back or this far ahead is a new session
+constexpr int32_t kReorderWindow = 32;
+constexpr int32_t kSessionJump = 1 << 16;
+constexpr int32_t kMaxPendingBehind = 16;
+constexpr uint64_t kPendingTimeoutMs = 1000;
+
+uint64_t nowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct PendingFrame {
+    uint64_t first_ms = 0;          // Arrival of its first fragment
+    uint32_t len = 0;
+    uint32_t timestamp_ms = 0;
+    uint8_t quality = 0;
+    uint16_t count = 0;
+    uint8_t fec_group = 0;
+    uint16_t received = 0;
+    std::vector<uint8_t> data;
+    std::vector<bool> have;
+    std::map<uint16_t, std::vector<uint8_t>> parity;   // Group index → XOR payload
+};
+
+struct Stats {
+    uint64_t complete = 0;
+    uint64_t lost = 0;              // Frame IDs that never completed
+    uint64_t discarded_partial = 0; // Of those, frames that had arrived in part
+    uint64_t fec_recovered = 0;     // Fragments rebuilt from parity
+    uint64_t packets = 0;
+    uint64_t bad_packets = 0;
+    std::vector<int64_t> staleness;
+    uint64_t max_gap_ms = 0;        // Longest time without a completed frame
+    uint64_t sessions = 0;          // Restarts after the first
+    uint64_t quality_sum = 0;       // Source quality scores of completed frames
+};
+
+size_t fragLen(const PendingFrame &f, uint16_t index) {
+    size_t off = (size_t)index * UDP_FRAME_MAX_PAYLOAD;
+    return std::min<size_t>(UDP_FRAME_MAX_PAYLOAD, f.len - off);
+}
+
+// Rebuild the single missing data fragment of a group from its parity.
+// Returns true if a fragment was recovered.
+bool tryRecover(PendingFrame &f, uint16_t group) {
+    auto it = f.parity.find(group);
+    if (it == f.parity.end() || f.fec_group == 0) return false;
+
+    uint16_t first = group * f.fec_group;
+    uint16_t last = std::min<uint16_t>(first + f.fec_group, f.count);
+    int missing = -1;
+    for (uint16_t i = first; i < last; i++) {
+        if (!f.have[i]) {
+            if (missing >= 0) return false;     // More than one lost: parity can't help
+            missing = i;
+        }
+    }
+    if (missing < 0) return false;
+
+    std::vector<uint8_t> rebuilt = it->second;
+    for (uint16_t i = first; i < last; i++) {
+        if (i == missing) continue;
+        const uint8_t *src = &f.data[(size_t)i * UDP_FRAME_MAX_PAYLOAD];
+        size_t len = fragLen(f, i);
+        for (size_t b = 0; b < len && b < rebuilt.size(); b++) rebuilt[b] ^= src[b];
+    }
+    size_t len = fragLen(f, missing);
+    if (rebuilt.size() < len) return false;
+    memcpy(&f.data[(size_t)missing * UDP_FRAME_MAX_PAYLOAD], rebuilt.data(), len);
+    f.have[missing] = true;
+    f.received++;
+    return true;
+}
+
+void sendControl(int sock, const sockaddr_in &device, const std::string &msg) {
+    sendto(sock, msg.data(), msg.size(), 0, (const sockaddr *)&device, sizeof(device));
+}
+
+void usage() {
+    fprintf(stderr, "usage: udp_receiver <device-ip> [--port N] [--fec N] [--out file.jpg] [--seconds N]\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    const char *deviceIp = argv[1];
+    int localPort = 5600;
+    int fec = 0;
+    const char *outPath = nullptr;
+    int seconds = 0;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--port" && i + 1 < argc) localPort = atoi(argv[++i]);
+        else if (a == "--fec" && i + 1 < argc) fec = atoi(argv[++i]);
+        else if (a == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if (a == "--seconds" && i + 1 < argc) seconds = atoi(argv[++i]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 1 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(localPort);
+    local.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    sockaddr_in device = {};
+    device.sin_family = AF_INET;
+    device.sin_port = htons(9999);
+    if (inet_pton(AF_INET, deviceIp, &device.sin_addr) != 1) {
+        fprintf(stderr, "bad device ip: %s\n", deviceIp);
+        return 2;
+    }
+    const std::string subscribe = "ROADSAFE_UDP_SUBSCRIBE:" + std::to_string(localPort) +
+                                  (fec > 0 ? ":" + std::to_string(fec) : "");
+
+    std::map<uint32_t, PendingFrame> pending;
+    Stats stats, window;
+    // IDs up to `resolved` are settled: completed, or given up on and counted
+    bool haveResolved = false;
+    uint32_t resolved = 0;
+    bool haveNewest = false;
+    uint32_t newest = 0;            // Highest frame ID seen this session
+    int64_t minOffset = INT64_MAX;
+    uint64_t start = nowMs();
+    uint64_t lastReport = start;
+    uint64_t lastRenew = 0;
+    uint64_t lastComplete = start;
+    uint64_t lastOk = 0;
+    std::vector<uint8_t> buf(sizeof(UdpFrameHeader) + UDP_FRAME_MAX_PAYLOAD + 64);
+
+    // Settle every ID up to upTo; all but upTo itself (if it just completed)
+    // are lost. Before the first settle, only frames actually seen count.
+    auto settle = [&](uint32_t upTo, bool completed) {
+        uint64_t partials = 0;
+        for (auto it = pending.begin(); it != pending.end();) {
+            if ((int32_t)(it->first - upTo) <= 0) {
+                if (!(completed && it->first == upTo)) partials++;
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        uint64_t lost = haveResolved ? (uint64_t)(upTo - resolved) - (completed ? 1 : 0) : partials;
+        for (Stats *s : {&stats, &window}) {
+            s->lost += lost;
+            s->discarded_partial += partials;
+        }
+        haveResolved = true;
+        resolved = upTo;
+    };
+
+    auto evictStale = [&](uint64_t now) {
+        bool any = false;
+        uint32_t cutoff = 0;
+        for (const auto &e : pending) {
+            if ((int32_t)(newest - e.first) > kMaxPendingBehind || now - e.second.first_ms > kPendingTimeoutMs) {
+                if (!any || (int32_t)(e.first - cutoff) > 0) cutoff = e.first;
+                any = true;
+            }
+        }
+        if (any) settle(cutoff, false);
+    };
+
+    printf("receiving on :%d from %s (fec %d)\n", localPort, deviceIp, fec);
+    for (;;) {
+        uint64_t now = nowMs();
+        if (seconds > 0 && now - start >= (uint64_t)seconds * 1000) break;
+        evictStale(now);
+        if (now - lastRenew >= UDP_SUB_TTL_MS / 2) {
+            sendControl(sock, device, subscribe);
+            lastRenew = now;
+        }
+
+        if (now - lastReport >= 1000) {
+            std::vector<int64_t> &st = window.staleness;
+            std::sort(st.begin(), st.end());
+            auto pct = [&](double p) { return st.empty() ? 0 : st[(size_t)(p * (st.size() - 1))]; };
+            uint64_t total = window.complete + window.lost;
+            // A stall completes nothing, so include the gap still open
+            uint64_t gap = std::max(window.max_gap_ms, now - lastComplete);
+            printf("fps %3llu  lost %3llu (%5.1f%%)  partial %3llu  fec %3llu  "
+                   "stale p50 %4lld p95 %4lld max %4lld ms  gap %4llu ms  quality %3llu\n",
+                   (unsigned long long)window.complete, (unsigned long long)window.lost,
+                   total ? 100.0 * window.lost / total : 0.0,
+                   (unsigned long long)window.discarded_partial,
+                   (unsigned long long)window.fec_recovered,
+                   (long long)pct(0.5), (long long)pct(0.95), (long long)(st.empty() ? 0 : st.back()),
+                   (unsigned long long)gap,
+                   (unsigned long long)(window.complete ? window.quality_sum / window.complete : 0));
+            fflush(stdout);
+            window = Stats();
+            lastReport = now;
+        }
+
+        pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        ssize_t n = recv(sock, buf.data(), buf.size(), 0);
+        if (n <= 0) continue;
+
+        auto newSession = [&](const char *why) {
+            if (haveResolved || !pending.empty()) {
+                printf("new session (%s)\n", why);
+                stats.sessions++;
+            }
+            pending.clear();
+            haveResolved = false;
+            haveNewest = false;
+            minOffset = INT64_MAX;
+        };
+
+        static const char kOk[] = "ROADSAFE_UDP_OK:";
+        if ((size_t)n >= sizeof(kOk) - 1 && memcmp(buf.data(), kOk, sizeof(kOk) - 1) == 0) {
+            // Renewals arrive every TTL/2; a longer silence means the device
+            // dropped us (or rebooted) and now counts frames from scratch
+            uint64_t okAt = nowMs();
+            if (lastOk != 0 && okAt - lastOk > UDP_SUB_TTL_MS) newSession("subscription renewed after lapse");
+            lastOk = okAt;
+            continue;
+        }
+        if (n < (ssize_t)sizeof(UdpFrameHeader)) continue;
+
+        UdpFrameHeader h;
+        memcpy(&h, buf.data(), sizeof(h));
+        const uint8_t *payload = buf.data() + sizeof(h);
+        stats.packets++;
+        if (h.magic != UDP_FRAME_MAGIC || h.version != UDP_FRAME_VERSION ||
+            sizeof(h) + h.payload_len > (size_t)n || h.payload_len > UDP_FRAME_MAX_PAYLOAD ||
+            h.frag_count == 0 || h.frame_len > (uint32_t)h.frag_count * UDP_FRAME_MAX_PAYLOAD ||
+            h.frame_len <= (uint32_t)(h.frag_count - 1) * UDP_FRAME_MAX_PAYLOAD) {
+            stats.bad_packets++;
+            continue;
+        }
+        if (haveResolved) {
+            int32_t ahead = (int32_t)(h.frame_id - resolved);
+            if (ahead < -kReorderWindow || ahead > kSessionJump) {
+                newSession("frame id jumped");
+            } else if (ahead <= 0) {
+                continue;   // Late fragment of a frame that is already done or given up on
+            }
+        }
+
+        if (!haveNewest || (int32_t)(h.frame_id - newest) > 0) newest = h.frame_id;
+        haveNewest = true;
+
+        PendingFrame &f = pending[h.frame_id];
+        if (f.count == 0) {
+            f.first_ms = nowMs();
+            f.len = h.frame_len;
+            f.timestamp_ms = h.timestamp_ms;
+            f.quality = h.quality;
+            f.count = h.frag_count;
+            f.fec_group = h.fec_group;
+            f.data.assign(f.len, 0);
+            f.have.assign(f.count, false);
+        }
+
+        if (h.frame_len != f.len || h.frag_count != f.count) {
+            stats.bad_packets++;
+            continue;
+        }
+
+        bool recovered = false;
+        if (h.flags & UDP_FRAME_FLAG_PARITY) {
+            f.parity[h.frag_index].assign(payload, payload + h.payload_len);
+            recovered = tryRecover(f, h.frag_index);
+        } else if (h.frag_index < f.count && !f.have[h.frag_index] &&
+                   h.payload_len == fragLen(f, h.frag_index)) {
+            memcpy(&f.data[(size_t)h.frag_index * UDP_FRAME_MAX_PAYLOAD], payload, h.payload_len);
+            f.have[h.frag_index] = true;
+            f.received++;
+            if (f.fec_group) recovered = tryRecover(f, h.frag_index / f.fec_group);
+        }
+        if (recovered) {
+            stats.fec_recovered++;
+            window.fec_recovered++;
+        }
+        if (f.received < f.count) continue;
+
+        // Complete: everything older is stale now and gets discarded
+        uint32_t id = h.frame_id;
+        uint64_t arrival = nowMs();
+        int64_t offset = (int64_t)arrival - f.timestamp_ms;
+        minOffset = std::min(minOffset, offset);
+        int64_t stale = offset - minOffset;
+        uint8_t quality = f.quality;
+
+        if (outPath) {
+            FILE *fp = fopen(outPath, "wb");
+            if (fp) {
+                fwrite(f.data.data(), 1, f.data.size(), fp);
+                fclose(fp);
+            }
+        }
+
+        // f is erased here together with every older frame
+        settle(id, true);
+        uint64_t gap = arrival - lastComplete;
+
+        for (Stats *s : {&stats, &window}) {
+            s->complete++;
+            s->staleness.push_back(stale);
+            s->max_gap_ms = std::max(s->max_gap_ms, gap);
+            s->quality_sum += quality;
+        }
+
+        lastComplete = arrival;
+    }
+
+    sendControl(sock, device, "ROADSAFE_UDP_UNSUBSCRIBE:" + std::to_string(localPort));
+    uint64_t total = stats.complete + stats.lost;
+    printf("total: %llu frames, %llu lost (%.1f%%), %llu partial discarded, %llu fec recovered, "
+           "%llu bad packets, longest gap %llu ms, %llu session restarts\n",
+           (unsigned long long)stats.complete, (unsigned long long)stats.lost,
+           total ? 100.0 * stats.lost / total : 0.0, (unsigned long long)stats.discarded_partial,
+           (unsigned long long)stats.fec_recovered, (unsigned long long)stats.bad_packets,
+           (unsigned long long)std::max(stats.max_gap_ms, nowMs() - lastComplete),
+           (unsigned long long)stats.sessions);
+    close(sock);
+    return 0;
+}